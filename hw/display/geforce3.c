@@ -13,16 +13,36 @@
 #include "hw/pci/pci.h"
 #include "hw/pci/pci_device.h"
 #include "hw/qdev-properties.h"
+#include "migration/blocker.h"
 #include "migration/vmstate.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "qemu/processor.h"
+#include "qemu/range.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
 #include "trace.h"
 #include "hw/display/vga.h"
 #include "hw/display/vga_int.h"
 #include "hw/display/edid.h"
 #include "hw/i2c/i2c.h"
 #include "qapi/error.h"
+#include "system/numa.h"
+#include "system/runstate.h"
 #include "ui/console.h"
+#include "geforce3_cache.h"
+#include "geforce3_engine.h"
+#include "geforce3_methods.h"
+#include "geforce3_pool.h"
+#include "geforce3_vbios.h"
+
+#ifdef CONFIG_NUMA
+#include <numaif.h>
+#endif
 
 #define TYPE_GEFORCE3 "geforce3"
 OBJECT_DECLARE_SIMPLE_TYPE(NVGFState, GEFORCE3)
@@ -44,111 +64,3590 @@ OBJECT_DECLARE_SIMPLE_TYPE(NVGFState, GEFORCE3)
 #define NV_PMC_BOOT_0           0x000000
 #define NV_PMC_INTR_0           0x000100
 #define NV_PMC_INTR_EN_0        0x000140
-#define NV_PBUS_PCI_NV_1        0x001804
+#define NV_PMC_ENABLE           0x000200
+#define   NV_PMC_ENABLE_PFIFO     (1 << 8)
+#define   NV_PMC_ENABLE_PGRAPH    (1 << 12)
+#define   NV_PMC_ENABLE_ENGINES   (NV_PMC_ENABLE_PFIFO | NV_PMC_ENABLE_PGRAPH)
+#define NV_PBUS_DEBUG_1         0x001218
+#define   NV_PBUS_DEBUG_1_DDR     (1 << 8)
+#define NV_PFB_CFG0             0x100200
+#define   NV_PFB_CFG0_PARTS_4     0x3
+#define NV_PFB_CSTATUS          0x10020c
+
+#define NV_PMC_INTR_0_PFIFO     (1 << 8)
+#define NV_PMC_INTR_0_PGRAPH    (1 << 12)
+
+/* BAR0 engine ranges */
+#define NV_BAR0_SIZE            0x1000000
+#define NV_PBUS_PCI_BASE        0x001800   /* PCI config space mirror */
+#define NV_PBUS_PCI_SIZE        0x000100
+#define NV_PFIFO_BASE           0x002000
+#define NV_PFIFO_SIZE           0x002000
+#define NV_PFB_BASE             0x100000
+#define NV_PFB_SIZE             0x001000
+#define NV_PGRAPH_BASE          0x400000
+#define NV_PGRAPH_SIZE          0x002000
+#define NV_PROM_BASE            0x300000   /* VBIOS mirror */
+#define NV_PRAMIN_BASE          0x700000
+#define NV_PRAMIN_SIZE          0x100000   /* last 1MB of VRAM */
+#define NV_USER_BASE            0x800000
+#define NV_USER_CHANNEL_SIZE    0x010000
+
+/* PFIFO registers */
+#define NV_PFIFO_INTR_0                 0x002100
+#define   NV_PFIFO_INTR_0_CACHE_ERROR     (1 << 0)
+#define   NV_PFIFO_INTR_0_DMA_PUSHER      (1 << 12)
+#define   NV_PFIFO_INTR_0_DMA_PT          (1 << 16)
+#define NV_PFIFO_INTR_EN_0              0x002140
+#define NV_PFIFO_RAMHT                  0x002210
+#define NV_PFIFO_RAMFC                  0x002214
+#define   NV_PFIFO_RAMFC_SIZE_64          (1 << 16)
+#define NV_PFIFO_RUNOUT_STATUS          0x002400
+#define   NV_PFIFO_RUNOUT_STATUS_LOW_MARK (1 << 4)
+#define NV_PFIFO_CACHES                 0x002500
+#define NV_PFIFO_MODE                   0x002504
+#define NV_PFIFO_CACHE1_PUSH1           0x003204
+#define   NV_PFIFO_CACHE1_PUSH1_DMA       (1 << 8)
+#define NV_PFIFO_CACHE1_STATUS          0x003214
+#define   NV_PFIFO_CACHE1_STATUS_EMPTY    (1 << 4)
+#define NV_PFIFO_CACHE1_DMA_STATE       0x003228
+#define NV_PFIFO_CACHE1_DMA_INSTANCE    0x00322c
+#define NV_PFIFO_CACHE1_DMA_PUT         0x003240
+#define NV_PFIFO_CACHE1_DMA_GET         0x003244
+#define NV_PFIFO_CACHE1_REF             0x003248
+#define NV_PFIFO_CACHE1_DMA_SUBROUTINE  0x00324c
+#define NV_PFIFO_CACHE1_PULL0           0x003250
+
+/* CACHE1_DMA_STATE layout, also saved in RAMFC */
+#define NV_DMA_STATE_NON_INCREASING     (1 << 0)
+#define NV_DMA_STATE_METHOD_SHIFT       2
+#define NV_DMA_STATE_METHOD_MASK        0x7ff
+#define NV_DMA_STATE_SUBCH_SHIFT        13
+#define NV_DMA_STATE_COUNT_SHIFT        18
+#define NV_DMA_STATE_COUNT_MASK         0x7ff
+#define NV_DMA_STATE_ERROR_SHIFT        29
+#define NV_DMA_ERROR_CALL_ACTIVE        1
+#define NV_DMA_ERROR_RETURN_INACTIVE    3
+#define NV_DMA_ERROR_INVALID_CMD        4
+#define NV_DMA_ERROR_PROTECTION         6
+
+/* PGRAPH registers */
+#define NV_PGRAPH_INTR                  0x400100
+#define   NV_PGRAPH_INTR_NOTIFY           (1 << 0)
+#define   NV_PGRAPH_INTR_ERROR            (1 << 20)
+#define NV_PGRAPH_INTR_EN               0x400140
+
+/* Per-channel USER registers */
+#define NV_USER_DMA_PUT                 0x40
+#define NV_USER_DMA_GET                 0x44
+#define NV_USER_REF                     0x48
+
+/* RAMFC entry, NV17+ layout */
+#define NV_RAMFC_DMA_PUT                0x00
+#define NV_RAMFC_DMA_GET                0x04
+#define NV_RAMFC_REF                    0x08
+#define NV_RAMFC_DMA_INSTANCE           0x0c
+#define NV_RAMFC_DMA_STATE              0x10
+#define NV_RAMFC_DMA_SUBROUTINE         0x30
+
+/* RAMHT entry context word */
+#define NV_RAMHT_INSTANCE               0x0000ffff
+#define NV_RAMHT_ENGINE_SHIFT           16
+#define NV_RAMHT_CHID_SHIFT             24
+#define NV_RAMHT_VALID                  0x80000000
+#define NV_ENGINE_SW                    0
+#define NV_ENGINE_GRAPHICS              1
+
+/* DMA objects in RAMIN */
+#define NV_DMA_CLASS_MASK               0x00000fff
+#define NV_DMA_TARGET_SHIFT             16
+#define NV_DMA_ADJUST_SHIFT             20
+#define NV_DMA_ADDRESS_MASK             0xfffff000
+#define NV_DMA_TARGET_NVM               0
+#define NV_DMA_TARGET_NVM_TILED         1
+#define NV_DMA_TARGET_PCI               2
+#define NV_DMA_TARGET_AGP               3
+
+/* Pushbuffer command words */
+#define NV_CMD_OLD_JUMP_MASK            0xe0000003
+#define NV_CMD_OLD_JUMP                 0x20000000
+#define NV_CMD_OLD_JUMP_OFFSET          0x1ffffffc
+#define NV_CMD_TYPE_MASK                0x00000003
+#define NV_CMD_JUMP                     0x00000001
+#define NV_CMD_CALL                     0x00000002
+#define NV_CMD_RETURN                   0x00020000
+#define NV_CMD_METHOD_MASK              0xe0030003
+#define NV_CMD_INCREASING               0x00000000
+#define NV_CMD_NON_INCREASING           0x40000000
+
+/* Methods executed by PFIFO rather than the bound object */
+#define NV_MTHD_SET_OBJECT              0x0000
+#define NV_MTHD_REF_CNT                 0x0050
+#define NV_MTHD_SEMAPHORE_CTXDMA        0x0060
+#define NV_MTHD_SEMAPHORE_OFFSET        0x0064
+#define NV_MTHD_SEMAPHORE_ACQUIRE       0x0068
+#define NV_MTHD_SEMAPHORE_RELEASE       0x006c
+#define NV_MTHD_OBJECT_BASE             0x0100
+
+/* Shadow of NV_NOTIFY while a notification is outstanding */
+#define NV_NOTIFY_PENDING               0x80000000
+#define NV_NOTIFY_AWAKEN                1
+
+/* M2MF copies at least this large are split across render threads */
+#define NV_M2MF_SPLIT_BYTES             (1 << 20)
+#define NV_M2MF_MAX_JOBS                8
+
+/*
+ * Vertex data collected between BEGIN and END, beyond which it is dropped
+ * so a guest that never ends a draw can't grow it without bound
+ */
+#define NV097_MAX_DRAW_INDEX            (1 << 20)
+#define NV097_MAX_INLINE_ARRAY          (16 * MiB)
+
+/* Pushbuffer window mapped or copied at once by the pusher */
+#define NV_PFIFO_FETCH_SIZE             (64 * KiB)
+
+/*
+ * With nothing to run, the PFIFO thread spins for a doorbell if the last
+ * one rang less than this long ago.  Channels blocked on a semaphore are
+ * polled, backing off up to the given interval while nothing changes.
+ */
+#define NV_PFIFO_SPIN_WINDOW_NS         (200 * SCALE_US)
+#define NV_PFIFO_POLL_MAX_MS            16
+
+#define NV_NUM_CHANNELS         32
+#define NV_NUM_SUBCHANNELS      8
+
+/* NV20 (GeForce3) architecture constants */
+#define NV_ARCH_20              0x20
+#define NV_IMPL_GEFORCE3        0x00
+#define NV_IMPL_GEFORCE3_TI200  0x01
+#define NV_IMPL_GEFORCE3_TI500  0x02
+
+typedef struct NVClass NVClass;
+
+/* Object bound to a subchannel with SET_OBJECT */
+typedef struct NVGRObject {
+    uint32_t handle;
+    uint32_t instance;
+    uint32_t engine;
+    uint32_t grclass;
+    const NVClass *cls;     /* NULL for classes we don't emulate */
+} NVGRObject;
+
+typedef struct NVDMAObject {
+    uint32_t dma_class;
+    uint32_t target;
+    hwaddr address;
+    uint32_t limit;
+} NVDMAObject;
+
+typedef struct NVDMAMapping {
+    void *ptr;
+    hwaddr addr;
+    hwaddr len;
+    bool is_write;
+    bool vram;
+    MemoryRegion *mr;       /* system memory RAM block, referenced */
+    hwaddr mr_offset;
+} NVDMAMapping;
+
+/* Kelvin state derived from the method shadow, one struct per group */
+typedef struct NVSurfaceState {
+    NVDMAObject color_dma;
+    NVDMAObject zeta_dma;
+    uint32_t color_offset;
+    uint32_t zeta_offset;
+    uint32_t color_pitch;
+    uint32_t zeta_pitch;
+    uint32_t color_format;
+    uint32_t zeta_format;
+    unsigned color_bpp;     /* bytes per pixel, 0 if not drawable */
+    unsigned zeta_bpp;
+    bool swizzled;
+    unsigned x, y, width, height;
+    int scissor[4];         /* window clip rectangle 0, exclusive */
+} NVSurfaceState;
+
+typedef struct NVBlendState {
+    bool blend;
+    uint32_t sfactor;
+    uint32_t dfactor;
+    uint32_t equation;
+    uint32_t color;
+    bool alpha_test;
+    uint32_t alpha_func;
+    uint32_t alpha_ref;
+    uint32_t write_mask;    /* A8R8G8B8 lanes that are written */
+    bool logic_op;
+    uint32_t logic_opcode;
+    bool dither;
+} NVBlendState;
+
+typedef struct NVDepthState {
+    bool test;
+    bool write;
+    uint32_t func;
+    bool stencil;
+    uint32_t stencil_func;
+    uint32_t stencil_ref;
+    uint32_t stencil_mask;
+    uint32_t stencil_write_mask;
+    uint32_t op_fail;
+    uint32_t op_zfail;
+    uint32_t op_zpass;
+    float clip_min;
+    float clip_max;
+    uint32_t shadow_func;
+} NVDepthState;
+
+typedef struct NVRasterState {
+    bool cull;
+    uint32_t cull_face;
+    bool front_ccw;
+    uint32_t front_mode;
+    uint32_t back_mode;
+    bool flat;
+    bool z_perspective;
+    float point_size;
+} NVRasterState;
+
+typedef struct NVTransformState {
+    bool program;           /* programmable vertex shader selected */
+    float viewport_scale[4];
+} NVTransformState;
+
+typedef struct NVVertexAttrib {
+    uint32_t type;
+    unsigned count;         /* components, 0 if the array is disabled */
+    unsigned stride;
+    uint32_t offset;
+    const NVDMAObject *dma;
+} NVVertexAttrib;
+
+typedef struct NVVertexState {
+    NVDMAObject dma_a;
+    NVDMAObject dma_b;
+    NVVertexAttrib attrib[NV097_NUM_ATTRIBS];
+} NVVertexState;
+
+typedef struct NVTextureState {
+    bool enabled;
+    NVDMAObject dma;
+    uint32_t offset;
+    uint32_t color_format;
+    unsigned dims;
+    unsigned levels;
+    unsigned width, height, depth;
+    unsigned pitch;         /* linear formats only */
+    bool cubemap;
+    uint32_t address;
+    uint32_t filter;
+    uint32_t border_color;
+    float min_lod, max_lod;
+    unsigned max_aniso;
+} NVTextureState;
+
+typedef struct NVKelvinState {
+    NVSurfaceState surface;
+    NVBlendState blend;
+    NVDepthState depth;
+    NVRasterState raster;
+    NVTransformState transform;
+    NVVertexState vertex;
+    NVTextureState texture[NV097_NUM_TEXTURES];
+    
+    /* Engine view of the groups above */
+    NVTnLState tnl;
+    NVRasterOps rop;
+} NVKelvinState;
+
+/* Post-transform vertex cache slot, valid for one draw */
+typedef struct NVVertexCacheEntry {
+    uint32_t index;
+    uint32_t vertex;        /* position in the draw's transformed vertices */
+    uint32_t draw;
+} NVVertexCacheEntry;
+
+/*
+ * PGRAPH context of one channel.  Contexts stay resident in host memory,
+ * so a context switch never copies state through RAMIN.  Method state is
+ * shadowed per class, indexed by method offset / 4.
+ */
+typedef struct NVGRContext {
+    unsigned chid;
+    NVGRObject subc[NV_NUM_SUBCHANNELS];
+    
+    uint32_t m2mf[NV_METHOD_TABLE_SIZE];
+    uint32_t surf2d[NV_METHOD_TABLE_SIZE];
+    uint32_t ifc[NV_METHOD_TABLE_SIZE];
+    uint32_t kelvin[NV_METHOD_TABLE_SIZE];
+    
+    uint32_t dirty;         /* NV097_DIRTY_* groups to rebuild */
+    NVKelvinState state;
+    GByteArray *inline_array;   /* INLINE_ARRAY data since BEGIN */
+    GArray *draw_index;         /* vertex indices since BEGIN */
+    bool draw_overflow;         /* vertex data dropped since BEGIN */
+    uint32_t primitive;         /* NV097_BEGIN_END_* being drawn */
+    NVVertexCacheEntry *vcache;
+    uint32_t vcache_draw;       /* tags the vcache entries of this draw */
+    uint32_t zpass_pixels;      /* occlusion query counter */
+    
+    /* Position in the IFC data stream, in bytes of the source line */
+    uint32_t ifc_pos;
+    uint32_t ifc_line;
+} NVGRContext;
+
+typedef struct NVChannel {
+    bool loaded;            /* resident here instead of in RAMFC */
+    bool put_written;       /* USER DMA_PUT written before DMA mode */
+    uint32_t dma_put;
+    uint32_t dma_get;
+    uint32_t ref;
+    uint32_t dma_instance;  /* pushbuffer DMA object, 16-byte units */
+    uint32_t subroutine;    /* return offset, bit 0 while active */
+    
+    /* Method decoder */
+    uint32_t method;
+    uint32_t subchannel;
+    uint32_t method_count;
+    bool non_increasing;
+    uint32_t error;         /* NV_DMA_ERROR_*, pusher halted if set */
+    
+    /* Semaphore state */
+    uint32_t semaphore_instance;
+    uint32_t semaphore_offset;
+    bool acquire_pending;
+    uint32_t acquire_value;
+    
+    NVGRContext *grctx;
+} NVChannel;
+
+typedef struct NVPFIFOState {
+    QemuMutex lock;
+    QemuCond cond;
+    QemuCond idle;          /* busy_chid went back to -1 */
+    QemuThread thread;
+    bool running;
+    bool stop;
+    bool preempt;           /* end the current timeslice early */
+    bool paused;            /* the VM is stopped, run nothing */
+    uint32_t timeslice_us;
+    uint32_t spin_us;
+    
+    /* Doorbells rung, and when the last one was */
+    uint32_t kicks;
+    int64_t last_kick;
+    unsigned poll_ms;
+    
+    uint32_t intr;
+    uint32_t intr_en;
+    uint32_t regs[NV_PFIFO_SIZE / 4];
+    uint8_t fetch_buf[NV_PFIFO_FETCH_SIZE]; /* for unmappable pushbuffers */
+    
+    NVChannel channels[NV_NUM_CHANNELS];
+    int cur_chid;           /* channel loaded into CACHE1, or -1 */
+    int busy_chid;          /* channel being executed, or -1 */
+} NVPFIFOState;
+
+/* Decoded texture bound at a VRAM address, see nv097_texture_get() */
+typedef struct NVTexBinding {
+    uint64_t desc;          /* format, size and layout */
+    hwaddr addr;
+    hwaddr len;
+    NVCacheEntry *entry;
+    uint32_t used;
+    bool stale;             /* VRAM written since it was decoded */
+} NVTexBinding;
+
+#define NV_TEX_BINDINGS 32
+
+/* VRAM that PGRAPH rendered to, in the layout it was written with */
+typedef struct NVSurfaceTag {
+    hwaddr addr;
+    uint32_t pitch;
+    unsigned bpp;
+    uint32_t used;
+} NVSurfaceTag;
+
+#define NV_SURFACE_TAGS 8
+
+typedef struct NVPGRAPHState {
+    uint32_t intr;
+    uint32_t intr_en;
+    uint32_t regs[NV_PGRAPH_SIZE / 4];
+    
+    NVGRContext *ctx;       /* context of the channel on the engine */
+    uint64_t ctx_switches;
+    
+    NVTexBinding tex[NV_TEX_BINDINGS];
+    uint32_t tex_clock;
+    NVSurfaceTag surface_tag[NV_SURFACE_TAGS];
+    uint32_t surface_clock;
+    
+    /*
+     * CPU writes to VRAM, harvested from the VGA dirty log under the BQL
+     * by dirty_bh on behalf of the PFIFO thread.  The handshake is
+     * protected by the PFIFO lock.
+     */
+    QEMUBH *dirty_bh;
+    QemuCond dirty_cond;
+    bool dirty_pending;     /* harvest requested */
+    bool dirty_done;        /* snapshots below are valid */
+    hwaddr scanout, scanout_end;
+    DirtyBitmapSnapshot *below, *above;
+    uint32_t dirty_kicks;   /* doorbells seen by the last harvest */
+    bool dirty_sync;        /* a semaphore acquire completed since */
+} NVPGRAPHState;
+
+typedef struct NVGFState {
+    PCIDevice parent_obj;
+    
+    /* VGA compatibility */
+    VGACommonState vga;
+    
+    /* Memory regions */
+    MemoryRegion mmio;
+    MemoryRegion lfb;
+    MemoryRegion crtc;
+    MemoryRegion ramin;
+    uint8_t *ramin_ptr;
+    MemoryRegion rom;
+    MemoryRegion prom;
+    
+    /* DDC/I2C support */
+    I2CBus *i2c_bus;
+    I2CSlave *i2c_ddc;
+    uint8_t ddc_state;
+    
+    /* EDID support */
+    qemu_edid_info edid_info;
+    uint8_t edid_blob[256];
+    bool edid_enabled;
+    
+    /* Device registers */
+    uint32_t prmvio[NV_PRMVIO_SIZE / 4];
+    
+    /* VBE support */
+    uint16_t vbe_index;
+    uint16_t vbe_regs[16]; /* VBE register array */
+    
+    /* NVIDIA-specific registers */
+    uint32_t pmc_boot_0;
+    uint32_t pmc_intr_0;
+    uint32_t pmc_intr_en_0;
+    uint32_t pmc_enable;
+    uint32_t architecture;
+    uint32_t implementation;
+    QEMUBH *irq_bh;
+    VMChangeStateEntry *vm_state;
+    Error *migration_blocker;
+    
+    /* Memory controller, CSTATUS holds the VRAM size */
+    uint32_t pfb[NV_PFB_SIZE / 4];
+    
+    /* Command processing */
+    NVPFIFOState pfifo;
+    NVPGRAPHState pgraph;
+    
+    /* Decoded texture cache */
+    bool shared_cache;
+    NVCacheTable *cache;
+    
+    /* Share of the process-wide render pool */
+    uint32_t render_threads;
+    char *render_affinity;
+    uint32_t render_weight;
+    NVRenderClient *render;
+    
+    /* Post-transform vertex cache entries, a power of two */
+    uint32_t vertex_cache;
+    
+    /* Host placement of VRAM */
+    bool vram_hugepages;
+    int32_t vram_numa_node;     /* -1 for the default policy */
+    char *vram_file;
+    bool vram_file_share;
+    int vram_fd;
+    
+} NVGFState;
+
+/* Forward declarations */
+static void geforce_ddc_init(NVGFState *s);
+static uint64_t geforce_ddc_read(void *opaque, hwaddr addr, unsigned size);
+static void geforce_ddc_write(void *opaque, hwaddr addr, uint64_t val, unsigned size);
+static void geforce_ui_info(void *opaque, uint32_t idx, QemuUIInfo *info);
+static uint32_t nv_compute_boot0(NVGFState *s);
+static void nv_apply_model_ids(NVGFState *s);
+static uint64_t nv_bar0_readl(void *opaque, hwaddr addr, unsigned size);
+
+/* VGA I/O operations */
+static uint64_t geforce_vga_ioport_read(void *opaque, hwaddr addr, unsigned size)
+{
+    NVGFState *s = opaque;
+    return vga_ioport_read(&s->vga, addr);
+}
+
+static void geforce_vga_ioport_write(void *opaque, hwaddr addr, uint64_t val, unsigned size)
+{
+    NVGFState *s = opaque;
+    vga_ioport_write(&s->vga, addr, val);
+}
+
+static const MemoryRegionOps geforce_vga_ops = {
+    .read = geforce_vga_ioport_read,
+    .write = geforce_vga_ioport_write,
+    .valid = {
+        .min_access_size = 1,
+        .max_access_size = 4,
+    },
+    .endianness = DEVICE_LITTLE_ENDIAN,
+};
+
+/* Compute PMC_BOOT_0 register value for nouveau driver compatibility */
+static uint32_t nv_compute_boot0(NVGFState *s)
+{
+    /* PMC_BOOT_0 format for nouveau driver:
+     * Bits 31-20: Architecture (0x20 for NV20/GeForce3)
+     * Bits 19-16: Implementation (0x00 for standard GeForce3)
+     * Bits 15-0:  Device/revision identification
+     * 
+     * For GeForce3 (NV20), nouveau expects: 0x20200XXX
+     * Where XXX contains device-specific revision information
+     */
+    uint32_t boot0 = (s->architecture << 20) | (s->architecture << 16) | (s->implementation << 4) | 0x00;
+    return boot0;
+}
+
+/* Apply device ID mappings for nouveau compatibility */
+static void nv_apply_model_ids(NVGFState *s)
+{
+    /* Set GeForce3 NV20 architecture */
+    s->architecture = NV_ARCH_20;
+    s->implementation = NV_IMPL_GEFORCE3;
+    
+    /* Compute PMC_BOOT_0 register */
+    s->pmc_boot_0 = nv_compute_boot0(s);
+    
+    /* Initialize other PMC registers */
+    s->pmc_intr_0 = 0x00000000;    /* No interrupts pending */
+    s->pmc_intr_en_0 = 0x00000000; /* Interrupts disabled initially */
+    s->pmc_enable = 0x00000000;    /* Engines off until the driver enables them */
+}
+
+/* Interrupt lines of all engines, folded into PMC_INTR_0 */
+static uint32_t nv_pmc_intr(NVGFState *s)
+{
+    uint32_t intr = s->pmc_intr_0;
+    
+    if (qatomic_read(&s->pfifo.intr) & s->pfifo.intr_en) {
+        intr |= NV_PMC_INTR_0_PFIFO;
+    }
+    if (qatomic_read(&s->pgraph.intr) & s->pgraph.intr_en) {
+        intr |= NV_PMC_INTR_0_PGRAPH;
+    }
+    return intr;
+}
+
+/* Must be called with the BQL held */
+static void nv_update_irq(NVGFState *s)
+{
+    pci_set_irq(&s->parent_obj, (s->pmc_intr_en_0 & 1) && nv_pmc_intr(s));
+}
+
+static void nv_irq_bh(void *opaque)
+{
+    nv_update_irq(opaque);
+}
+
+/* Engine interrupts may be raised from the PFIFO thread */
+static void nv_pfifo_raise(NVGFState *s, uint32_t bits)
+{
+    qatomic_or(&s->pfifo.intr, bits);
+    qemu_bh_schedule(s->irq_bh);
+}
+
+static void nv_pgraph_raise(NVGFState *s, uint32_t bits)
+{
+    qatomic_or(&s->pgraph.intr, bits);
+    qemu_bh_schedule(s->irq_bh);
+}
+
+static inline uint32_t nv_ramin_rd32(NVGFState *s, uint32_t offset)
+{
+    return ldl_le_p(s->ramin_ptr + (offset & (NV_PRAMIN_SIZE - 4)));
+}
+
+static inline void nv_ramin_wr32(NVGFState *s, uint32_t offset, uint32_t val)
+{
+    stl_le_p(s->ramin_ptr + (offset & (NV_PRAMIN_SIZE - 4)), val);
+}
+
+/* Decode the DMA object at RAMIN byte offset @instance */
+static void nv_dma_load(NVGFState *s, uint32_t instance, NVDMAObject *dma)
+{
+    uint32_t flags = nv_ramin_rd32(s, instance);
+    uint32_t frame = nv_ramin_rd32(s, instance + 8);
+    
+    dma->dma_class = flags & NV_DMA_CLASS_MASK;
+    dma->target = (flags >> NV_DMA_TARGET_SHIFT) & 3;
+    dma->address = (frame & NV_DMA_ADDRESS_MASK) | (flags >> NV_DMA_ADJUST_SHIFT);
+    dma->limit = nv_ramin_rd32(s, instance + 4);
+}
+
+/*
+ * System memory is only reached where it is RAM.  The PFIFO thread runs
+ * without the BQL, which MMIO would need, while the BQL holder may be
+ * waiting for the thread to stop or go idle: anything else is refused
+ * with a DMA page table fault.  Called under RCU; returns the RAM region
+ * holding the first *@len bytes at @addr, trimmed to what it holds.
+ */
+static MemoryRegion *nv_sysmem_translate(NVGFState *s, hwaddr addr,
+                                         hwaddr *xlat, hwaddr *len,
+                                         bool is_write)
+{
+    MemoryRegion *mr;
+    
+    mr = address_space_translate(pci_get_address_space(&s->parent_obj),
+                                 addr, xlat, len, is_write,
+                                 MEMTXATTRS_UNSPECIFIED);
+    if (!memory_access_is_direct(mr, is_write, MEMTXATTRS_UNSPECIFIED)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: DMA to 0x%" HWADDR_PRIx
+                      " is not RAM\n", addr);
+        nv_pfifo_raise(s, NV_PFIFO_INTR_0_DMA_PT);
+        return NULL;
+    }
+    return mr;
+}
+
+/* Copy to or from system memory, which may span several RAM blocks */
+static bool nv_sysmem_rw(NVGFState *s, hwaddr addr, void *buf, hwaddr len,
+                         bool is_write)
+{
+    MemoryRegion *mr;
+    hwaddr xlat, l;
+    uint8_t *p;
+    
+    RCU_READ_LOCK_GUARD();
+    while (len) {
+        l = len;
+        mr = nv_sysmem_translate(s, addr, &xlat, &l, is_write);
+        if (!mr) {
+            return false;
+        }
+        p = (uint8_t *)memory_region_get_ram_ptr(mr) + xlat;
+        if (is_write) {
+            memcpy(p, buf, l);
+            memory_region_set_dirty(mr, xlat, l);
+        } else {
+            memcpy(buf, p, l);
+        }
+        addr += l;
+        buf = (uint8_t *)buf + l;
+        len -= l;
+    }
+    return true;
+}
+
+static bool nv_dma_rd32(NVGFState *s, const NVDMAObject *dma, uint32_t offset,
+                        uint32_t *val)
+{
+    hwaddr addr = dma->address + offset;
+    uint32_t le;
+    
+    if (offset > dma->limit - 3 || dma->limit < 3) {
+        return false;
+    }
+    if (dma->target == NV_DMA_TARGET_NVM ||
+        dma->target == NV_DMA_TARGET_NVM_TILED) {
+        if (addr + 4 > s->vga.vram_size) {
+            return false;
+        }
+        *val = ldl_le_p(s->vga.vram_ptr + addr);
+        return true;
+    }
+    if (!nv_sysmem_rw(s, addr, &le, 4, false)) {
+        return false;
+    }
+    *val = le32_to_cpu(le);
+    return true;
+}
+
+/*
+ * The engine wrote @len bytes of VRAM at @addr; PFIFO thread only.  These
+ * writes mark the texture bindings directly, the dirty log only has to
+ * catch the CPU.
+ */
+static void nv_pgraph_vram_written(NVGFState *s, hwaddr addr, hwaddr len)
+{
+    NVTexBinding *b;
+    int i;
+    
+    for (i = 0; i < NV_TEX_BINDINGS; i++) {
+        b = &s->pgraph.tex[i];
+        if (b->entry && addr < b->addr + b->len && b->addr < addr + len) {
+            b->stale = true;
+        }
+    }
+}
+
+static bool nv_dma_wr32(NVGFState *s, const NVDMAObject *dma, uint32_t offset,
+                        uint32_t val)
+{
+    hwaddr addr = dma->address + offset;
+    uint32_t le = cpu_to_le32(val);
+    
+    if (offset > dma->limit - 3 || dma->limit < 3) {
+        return false;
+    }
+    if (dma->target == NV_DMA_TARGET_NVM ||
+        dma->target == NV_DMA_TARGET_NVM_TILED) {
+        if (addr + 4 > s->vga.vram_size) {
+            return false;
+        }
+        stl_le_p(s->vga.vram_ptr + addr, val);
+        memory_region_set_dirty(&s->vga.vram, addr, 4);
+        nv_pgraph_vram_written(s, addr, 4);
+        return true;
+    }
+    return nv_sysmem_rw(s, addr, &le, 4, true);
+}
+
+static bool nv_dma_is_vram(const NVDMAObject *dma)
+{
+    return dma->target == NV_DMA_TARGET_NVM ||
+           dma->target == NV_DMA_TARGET_NVM_TILED;
+}
+
+static bool nv_dma_check(NVGFState *s, const NVDMAObject *dma,
+                         uint32_t offset, hwaddr len)
+{
+    if (!len || offset > dma->limit || len - 1 > dma->limit - offset) {
+        return false;
+    }
+    return !nv_dma_is_vram(dma) ||
+           dma->address + offset + len <= s->vga.vram_size;
+}
+
+/*
+ * Map @len bytes of a DMA object for direct access.  VRAM is always
+ * mapped; system memory only if it is one block of RAM, otherwise
+ * callers bounce.
+ */
+static void *nv_dma_map(NVGFState *s, const NVDMAObject *dma, uint32_t offset,
+                        hwaddr len, bool is_write, NVDMAMapping *m)
+{
+    hwaddr mapped = len;
+    
+    m->ptr = NULL;
+    m->addr = dma->address + offset;
+    m->len = len;
+    m->is_write = is_write;
+    m->vram = nv_dma_is_vram(dma);
+    m->mr = NULL;
+    
+    if (!nv_dma_check(s, dma, offset, len)) {
+        return NULL;
+    }
+    if (m->vram) {
+        m->ptr = s->vga.vram_ptr + m->addr;
+        return m->ptr;
+    }
+    
+    RCU_READ_LOCK_GUARD();
+    m->mr = nv_sysmem_translate(s, m->addr, &m->mr_offset, &mapped,
+                                is_write);
+    if (!m->mr || mapped < len) {
+        m->mr = NULL;
+        return NULL;
+    }
+    memory_region_ref(m->mr);
+    m->ptr = (uint8_t *)memory_region_get_ram_ptr(m->mr) + m->mr_offset;
+    return m->ptr;
+}
+
+static void nv_dma_unmap(NVGFState *s, NVDMAMapping *m)
+{
+    if (!m->ptr) {
+        return;
+    }
+    if (m->vram) {
+        if (m->is_write) {
+            memory_region_set_dirty(&s->vga.vram, m->addr, m->len);
+            nv_pgraph_vram_written(s, m->addr, m->len);
+        }
+    } else {
+        if (m->is_write) {
+            memory_region_set_dirty(m->mr, m->mr_offset, m->len);
+        }
+        memory_region_unref(m->mr);
+        m->mr = NULL;
+    }
+    m->ptr = NULL;
+}
+
+static bool nv_dma_read(NVGFState *s, const NVDMAObject *dma, uint32_t offset,
+                        void *buf, hwaddr len)
+{
+    if (!nv_dma_check(s, dma, offset, len)) {
+        return false;
+    }
+    if (nv_dma_is_vram(dma)) {
+        memcpy(buf, s->vga.vram_ptr + dma->address + offset, len);
+        return true;
+    }
+    return nv_sysmem_rw(s, dma->address + offset, buf, len, false);
+}
+
+static bool nv_dma_write(NVGFState *s, const NVDMAObject *dma,
+                         uint32_t offset, const void *buf, hwaddr len)
+{
+    hwaddr addr = dma->address + offset;
+    
+    if (!nv_dma_check(s, dma, offset, len)) {
+        return false;
+    }
+    if (nv_dma_is_vram(dma)) {
+        memcpy(s->vga.vram_ptr + addr, buf, len);
+        memory_region_set_dirty(&s->vga.vram, addr, len);
+        nv_pgraph_vram_written(s, addr, len);
+        return true;
+    }
+    return nv_sysmem_rw(s, addr, (void *)buf, len, true);
+}
+
+/* Find the RAMHT context word of @handle as seen by channel @chid */
+static bool nv_ramht_lookup(NVGFState *s, unsigned chid, uint32_t handle,
+                            uint32_t *context)
+{
+    uint32_t ramht = s->pfifo.regs[(NV_PFIFO_RAMHT - NV_PFIFO_BASE) / 4];
+    uint32_t base = (ramht & 0xfff) << 8;
+    unsigned bits = 9 + ((ramht >> 16) & 3);
+    uint32_t entries = 1 << bits;
+    uint32_t hash = 0, h = handle, i, ctx;
+    
+    while (h) {
+        hash ^= h & (entries - 1);
+        h >>= bits;
+    }
+    hash ^= chid << (bits - 4);
+    
+    /* Collisions are resolved by linear probing */
+    for (i = 0; i < entries; i++, hash = (hash + 1) & (entries - 1)) {
+        ctx = nv_ramin_rd32(s, base + hash * 8 + 4);
+        if (!(ctx & NV_RAMHT_VALID)) {
+            break;
+        }
+        if (nv_ramin_rd32(s, base + hash * 8) == handle &&
+            ((ctx >> NV_RAMHT_CHID_SHIFT) & 0x1f) == chid) {
+            *context = ctx;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t nv_ramfc_base(NVGFState *s, unsigned chid)
+{
+    uint32_t ramfc = s->pfifo.regs[(NV_PFIFO_RAMFC - NV_PFIFO_BASE) / 4];
+    
+    return ((ramfc & 0xfff) << 8) +
+           chid * ((ramfc & NV_PFIFO_RAMFC_SIZE_64) ? 64 : 32);
+}
+
+static uint32_t nv_channel_dma_state(NVChannel *ch)
+{
+    return (ch->non_increasing ? NV_DMA_STATE_NON_INCREASING : 0) |
+           ((ch->method >> 2) & NV_DMA_STATE_METHOD_MASK) << NV_DMA_STATE_METHOD_SHIFT |
+           ch->subchannel << NV_DMA_STATE_SUBCH_SHIFT |
+           ch->method_count << NV_DMA_STATE_COUNT_SHIFT |
+           ch->error << NV_DMA_STATE_ERROR_SHIFT;
+}
+
+/*
+ * Channel state is only read from RAMFC when the channel is first used,
+ * and only written back when the guest disables it.  Called with the
+ * PFIFO lock held.
+ */
+static NVChannel *nv_pfifo_load_channel(NVGFState *s, unsigned chid)
+{
+    NVChannel *ch = &s->pfifo.channels[chid];
+    uint32_t fc, state;
+    
+    if (ch->loaded) {
+        return ch;
+    }
+    
+    fc = nv_ramfc_base(s, chid);
+    state = nv_ramin_rd32(s, fc + NV_RAMFC_DMA_STATE);
+    ch->dma_put = nv_ramin_rd32(s, fc + NV_RAMFC_DMA_PUT);
+    ch->dma_get = nv_ramin_rd32(s, fc + NV_RAMFC_DMA_GET);
+    ch->ref = nv_ramin_rd32(s, fc + NV_RAMFC_REF);
+    ch->dma_instance = nv_ramin_rd32(s, fc + NV_RAMFC_DMA_INSTANCE) & 0xffff;
+    ch->subroutine = nv_ramin_rd32(s, fc + NV_RAMFC_DMA_SUBROUTINE);
+    ch->non_increasing = state & NV_DMA_STATE_NON_INCREASING;
+    ch->method = ((state >> NV_DMA_STATE_METHOD_SHIFT) &
+                  NV_DMA_STATE_METHOD_MASK) << 2;
+    ch->subchannel = (state >> NV_DMA_STATE_SUBCH_SHIFT) & 7;
+    ch->method_count = (state >> NV_DMA_STATE_COUNT_SHIFT) &
+                       NV_DMA_STATE_COUNT_MASK;
+    ch->error = 0;
+    ch->acquire_pending = false;
+    ch->loaded = true;
+    return ch;
+}
+
+static void nv_grctx_free(NVGRContext *ctx)
+{
+    if (!ctx) {
+        return;
+    }
+    if (ctx->inline_array) {
+        g_byte_array_unref(ctx->inline_array);
+    }
+    if (ctx->draw_index) {
+        g_array_unref(ctx->draw_index);
+    }
+    g_free(ctx->vcache);
+    g_free(ctx);
+}
+
+/* Called with the PFIFO lock held, never for the busy channel */
+static void nv_pfifo_unload_channel(NVGFState *s, unsigned chid)
+{
+    NVChannel *ch = &s->pfifo.channels[chid];
+    uint32_t fc = nv_ramfc_base(s, chid);
+    
+    if (!ch->loaded) {
+        return;
+    }
+    
+    nv_ramin_wr32(s, fc + NV_RAMFC_DMA_PUT, ch->dma_put);
+    nv_ramin_wr32(s, fc + NV_RAMFC_DMA_GET, ch->dma_get);
+    nv_ramin_wr32(s, fc + NV_RAMFC_REF, ch->ref);
+    nv_ramin_wr32(s, fc + NV_RAMFC_DMA_STATE, nv_channel_dma_state(ch));
+    nv_ramin_wr32(s, fc + NV_RAMFC_DMA_SUBROUTINE, ch->subroutine);
+    
+    if (s->pgraph.ctx == ch->grctx) {
+        s->pgraph.ctx = NULL;
+    }
+    nv_grctx_free(ch->grctx);
+    ch->grctx = NULL;
+    ch->loaded = false;
+    if (s->pfifo.cur_chid == chid) {
+        s->pfifo.cur_chid = -1;
+    }
+}
+
+/*
+ * The guest has just set up RAMFC for @chid and put it in DMA mode.  A
+ * DMA_PUT it wrote before that is newer than the one in RAMFC.  Called
+ * with the PFIFO lock held.
+ */
+static void nv_pfifo_enable_channel(NVGFState *s, unsigned chid)
+{
+    NVChannel *ch = &s->pfifo.channels[chid];
+    uint32_t put = ch->dma_put;
+    
+    ch->loaded = false;
+    nv_pfifo_load_channel(s, chid);
+    if (ch->put_written) {
+        ch->dma_put = put;
+        ch->put_written = false;
+    }
+}
+
+/*
+ * Take the channels in @mask off the pusher before their mode changes,
+ * cutting the current timeslice short.  Called with the PFIFO lock held.
+ */
+static void nv_pfifo_wait_idle(NVGFState *s, uint32_t mask)
+{
+    NVPFIFOState *f = &s->pfifo;
+    
+    while (f->busy_chid >= 0 && (mask & BIT(f->busy_chid))) {
+        qatomic_set(&f->preempt, true);
+        qemu_cond_broadcast(&s->pgraph.dirty_cond);
+        qemu_cond_wait(&f->idle, &f->lock);
+    }
+    qatomic_set(&f->preempt, false);
+}
+
+static bool nv_semaphore_ready(NVGFState *s, NVChannel *ch)
+{
+    NVDMAObject dma;
+    uint32_t val;
+    
+    nv_dma_load(s, ch->semaphore_instance, &dma);
+    return nv_dma_rd32(s, &dma, ch->semaphore_offset, &val) &&
+           val == ch->acquire_value;
+}
+
+/* Called with the PFIFO lock held */
+static bool nv_pfifo_runnable(NVGFState *s, unsigned chid)
+{
+    NVPFIFOState *f = &s->pfifo;
+    NVChannel *ch = &f->channels[chid];
+    
+    if (!(f->regs[(NV_PFIFO_MODE - NV_PFIFO_BASE) / 4] & BIT(chid)) ||
+        !ch->loaded || ch->error) {
+        return false;
+    }
+    if (ch->acquire_pending && !nv_semaphore_ready(s, ch)) {
+        return false;
+    }
+    return ch->dma_put != ch->dma_get || ch->acquire_pending;
+}
+
+/* Round robin, starting after the channel that ran last */
+static int nv_pfifo_next_channel(NVGFState *s, bool *blocked)
+{
+    NVPFIFOState *f = &s->pfifo;
+    int start = f->cur_chid < 0 ? 0 : f->cur_chid + 1;
+    int i, chid;
+    
+    *blocked = false;
+    if (!(f->regs[(NV_PFIFO_CACHES - NV_PFIFO_BASE) / 4] & 1) ||
+        !(f->regs[(NV_PFIFO_CACHE1_PULL0 - NV_PFIFO_BASE) / 4] & 1)) {
+        return -1;
+    }
+    
+    for (i = 0; i < NV_NUM_CHANNELS; i++) {
+        chid = (start + i) % NV_NUM_CHANNELS;
+        if (nv_pfifo_runnable(s, chid)) {
+            return chid;
+        }
+        *blocked |= f->channels[chid].acquire_pending;
+    }
+    return -1;
+}
+
+/*
+ * Put @chid on CACHE1 and its context on PGRAPH.  Every channel has a
+ * context of its own, allocated when it first runs; running the same
+ * channel again is free.  Called with the PFIFO lock held.
+ */
+static void nv_pfifo_switch_channel(NVGFState *s, unsigned chid)
+{
+    NVChannel *ch = &s->pfifo.channels[chid];
+    
+    s->pfifo.cur_chid = chid;
+    s->pfifo.regs[(NV_PFIFO_CACHE1_PUSH1 - NV_PFIFO_BASE) / 4] =
+        chid | NV_PFIFO_CACHE1_PUSH1_DMA;
+    
+    if (!ch->grctx) {
+        ch->grctx = g_new0(NVGRContext, 1);
+        ch->grctx->chid = chid;
+        ch->grctx->dirty = NV097_DIRTY_ALL;
+    }
+    if (s->pgraph.ctx != ch->grctx) {
+        s->pgraph.ctx = ch->grctx;
+        s->pgraph.ctx_switches++;
+    }
+}
+
+typedef void NVMethodFn(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                        uint32_t method, uint32_t param);
+
+/* @data holds @count little-endian words straight from the pushbuffer */
+typedef void NVMethodBulkFn(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                            uint32_t method, const void *data,
+                            unsigned count);
+
+struct NVClass {
+    uint32_t grclass;
+    const char *name;
+    size_t state;           /* offset of the method shadow in NVGRContext */
+    NVMethodFn * const *methods;
+    NVMethodBulkFn * const *bulk;
+};
+
+static void nv_mthd_nop(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                        uint32_t method, uint32_t param)
+{
+}
+
+static void nv_mthd_store(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                          uint32_t method, uint32_t param)
+{
+    regs[method / 4] = param;
+}
+
+/* Resolve a DMA object handle and keep its instance offset */
+static void nv_mthd_ctxdma(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                           uint32_t method, uint32_t param)
+{
+    uint32_t context;
+    
+    if (!nv_ramht_lookup(s, ctx->chid, param, &context)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: channel %u: no DMA object "
+                      "0x%08x in RAMHT\n", ctx->chid, param);
+        nv_pgraph_raise(s, NV_PGRAPH_INTR_ERROR);
+        return;
+    }
+    regs[method / 4] = (context & NV_RAMHT_INSTANCE) << 4;
+}
+
+static void nv_mthd_notify(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                           uint32_t method, uint32_t param)
+{
+    regs[method / 4] = param | NV_NOTIFY_PENDING;
+}
+
+/* Complete a notification armed with NV_NOTIFY, if any */
+static void nv_pgraph_notify(NVGFState *s, uint32_t *regs)
+{
+    uint32_t notify = regs[NV_NOTIFY / 4];
+    uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    NVDMAObject dma;
+    
+    if (!(notify & NV_NOTIFY_PENDING)) {
+        return;
+    }
+    regs[NV_NOTIFY / 4] = notify & ~NV_NOTIFY_PENDING;
+    
+    /* Timestamp, info32, then info16 and a zero status meaning done */
+    nv_dma_load(s, regs[NV_SET_CONTEXT_DMA_NOTIFIES / 4], &dma);
+    nv_dma_wr32(s, &dma, 0x0, now);
+    nv_dma_wr32(s, &dma, 0x4, now >> 32);
+    nv_dma_wr32(s, &dma, 0x8, 0);
+    nv_dma_wr32(s, &dma, 0xc, 0);
+    if (notify & NV_NOTIFY_AWAKEN) {
+        nv_pgraph_raise(s, NV_PGRAPH_INTR_NOTIFY);
+    }
+}
+
+typedef struct NVCopyJob {
+    NVRenderJob job;
+    uint8_t *dst;
+    const uint8_t *src;
+    size_t len;
+    unsigned lines;
+    int32_t pitch_in;
+    int32_t pitch_out;
+} NVCopyJob;
+
+static void nv_copy_lines(void *opaque)
+{
+    NVCopyJob *c = opaque;
+    unsigned i;
+    
+    for (i = 0; i < c->lines; i++) {
+        memmove(c->dst + (ptrdiff_t)i * c->pitch_out,
+                c->src + (ptrdiff_t)i * c->pitch_in, c->len);
+    }
+}
+
+/*
+ * Copy between two mapped spans.  Large copies whose source and
+ * destination don't overlap are cut into chunks for the render pool.
+ */
+static void nv_m2mf_copy(NVGFState *s, NVCopyJob *c, size_t span_in,
+                         size_t span_out)
+{
+    NVCopyJob jobs[NV_M2MF_MAX_JOBS];
+    NVRenderBatch batch;
+    size_t total = c->len * c->lines;
+    unsigned n, i, first, step;
+    
+    n = MIN(total / NV_M2MF_SPLIT_BYTES, NV_M2MF_MAX_JOBS);
+    if (n < 2 || ranges_overlap((uintptr_t)c->dst, span_out,
+                                (uintptr_t)c->src, span_in)) {
+        nv_copy_lines(c);
+        return;
+    }
+    
+    nv_render_batch_init(&batch, s->render);
+    if (c->lines == 1) {
+        /* One long line, split by bytes */
+        step = ROUND_UP(DIV_ROUND_UP(c->len, n), 64);
+        for (i = 0; i < n && (size_t)i * step < c->len; i++) {
+            jobs[i] = *c;
+            jobs[i].dst += (size_t)i * step;
+            jobs[i].src += (size_t)i * step;
+            jobs[i].len = MIN(step, c->len - (size_t)i * step);
+            jobs[i].job.fn = nv_copy_lines;
+            jobs[i].job.opaque = &jobs[i];
+            jobs[i].job.cost = jobs[i].len;
+            nv_render_submit(&batch, &jobs[i].job);
+        }
+    } else {
+        n = MIN(n, c->lines);
+        step = DIV_ROUND_UP(c->lines, n);
+        for (i = 0, first = 0; first < c->lines; i++, first += step) {
+            jobs[i] = *c;
+            jobs[i].dst += (ptrdiff_t)first * c->pitch_out;
+            jobs[i].src += (ptrdiff_t)first * c->pitch_in;
+            jobs[i].lines = MIN(step, c->lines - first);
+            jobs[i].job.fn = nv_copy_lines;
+            jobs[i].job.opaque = &jobs[i];
+            jobs[i].job.cost = jobs[i].len * jobs[i].lines;
+            nv_render_submit(&batch, &jobs[i].job);
+        }
+    }
+    nv_render_batch_wait(&batch);
+    nv_render_batch_destroy(&batch);
+}
+
+/* Line by line through a bounce buffer, for memory we can't map */
+static bool nv_m2mf_bounce(NVGFState *s, const NVDMAObject *in,
+                           const NVDMAObject *out, const uint32_t *regs)
+{
+    uint32_t len = regs[NV039_LINE_LENGTH_IN / 4];
+    uint32_t count = regs[NV039_LINE_COUNT / 4];
+    uint32_t offset_in = regs[NV039_OFFSET_IN / 4];
+    uint32_t offset_out = regs[NV039_OFFSET_OUT / 4];
+    g_autofree uint8_t *buf = g_malloc(len);
+    uint32_t i;
+    
+    for (i = 0; i < count; i++) {
+        if (!nv_dma_read(s, in, offset_in, buf, len) ||
+            !nv_dma_write(s, out, offset_out, buf, len)) {
+            return false;
+        }
+        offset_in += regs[NV039_PITCH_IN / 4];
+        offset_out += regs[NV039_PITCH_OUT / 4];
+    }
+    return true;
+}
+
+static void nv039_buffer_notify(NVGFState *s, NVGRContext *ctx,
+                                uint32_t *regs, uint32_t method,
+                                uint32_t param)
+{
+    int32_t pitch_in = regs[NV039_PITCH_IN / 4];
+    int32_t pitch_out = regs[NV039_PITCH_OUT / 4];
+    uint32_t len = regs[NV039_LINE_LENGTH_IN / 4];
+    uint32_t count = regs[NV039_LINE_COUNT / 4];
+    uint32_t format = regs[NV039_FORMAT / 4];
+    NVDMAMapping min, mout;
+    NVDMAObject in, out;
+    NVCopyJob c;
+    uint64_t span_in, span_out;
+    bool ok = true;
+    
+    regs[method / 4] = param;
+    if (format != NV039_FORMAT_BYTES || pitch_in < 0 || pitch_out < 0) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: M2MF format 0x%x pitch %d/%d\n",
+                      format, pitch_in, pitch_out);
+        goto done;
+    }
+    if (!len || !count) {
+        goto done;
+    }
+    
+    nv_dma_load(s, regs[NV039_SET_CONTEXT_DMA_BUFFER_IN / 4], &in);
+    nv_dma_load(s, regs[NV039_SET_CONTEXT_DMA_BUFFER_OUT / 4], &out);
+    
+    c = (NVCopyJob) {
+        .len = len,
+        .lines = count,
+        .pitch_in = pitch_in,
+        .pitch_out = pitch_out,
+    };
+    /* Packed lines are one contiguous copy */
+    if (pitch_in == len && pitch_out == len) {
+        c.len = (size_t)len * count;
+        c.lines = 1;
+    }
+    span_in = (uint64_t)(c.lines - 1) * pitch_in + c.len;
+    span_out = (uint64_t)(c.lines - 1) * pitch_out + c.len;
+    
+    c.src = nv_dma_map(s, &in, regs[NV039_OFFSET_IN / 4], span_in, false,
+                       &min);
+    c.dst = nv_dma_map(s, &out, regs[NV039_OFFSET_OUT / 4], span_out, true,
+                       &mout);
+    if (c.src && c.dst) {
+        nv_m2mf_copy(s, &c, span_in, span_out);
+    }
+    nv_dma_unmap(s, &min);
+    nv_dma_unmap(s, &mout);
+    if (!c.src || !c.dst) {
+        ok = nv_m2mf_bounce(s, &in, &out, regs);
+    }
+    if (!ok) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: M2MF transfer outside "
+                      "its DMA objects\n");
+        nv_pgraph_raise(s, NV_PGRAPH_INTR_ERROR);
+    }
+    
+done:
+    nv_pgraph_notify(s, regs);
+}
+
+static void nv097_semaphore_release(NVGFState *s, NVGRContext *ctx,
+                                    uint32_t *regs, uint32_t method,
+                                    uint32_t param)
+{
+    NVDMAObject dma;
+    
+    nv_dma_load(s, regs[NV097_SET_CONTEXT_DMA_SEMAPHORE / 4], &dma);
+    nv_dma_wr32(s, &dma, regs[NV097_SET_SEMAPHORE_OFFSET / 4], param);
+}
+
+static void nv097_clear_report_value(NVGFState *s, NVGRContext *ctx,
+                                     uint32_t *regs, uint32_t method,
+                                     uint32_t param)
+{
+    if (param == NV097_REPORT_TYPE_ZPASS_PIXEL_CNT) {
+        ctx->zpass_pixels = 0;
+    }
+}
+
+/* Occlusion query result: timestamp, pixel count and a zero status */
+static void nv097_get_report(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                             uint32_t method, uint32_t param)
+{
+    uint32_t offset = param & NV097_GET_REPORT_OFFSET_MASK;
+    uint64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    NVDMAObject dma;
+    
+    if (param >> NV097_GET_REPORT_TYPE_SHIFT !=
+        NV097_REPORT_TYPE_ZPASS_PIXEL_CNT) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: report type %u not supported\n",
+                      param >> NV097_GET_REPORT_TYPE_SHIFT);
+        return;
+    }
+    nv_dma_load(s, regs[NV097_SET_CONTEXT_DMA_REPORT / 4], &dma);
+    nv_dma_wr32(s, &dma, offset, now);
+    nv_dma_wr32(s, &dma, offset + 0x4, now >> 32);
+    nv_dma_wr32(s, &dma, offset + 0x8, ctx->zpass_pixels);
+    nv_dma_wr32(s, &dma, offset + 0xc, 0);
+}
+
+#define NV_DIRTY_ENTRY(mthd, n, groups) \
+    [(mthd) / 4 ... (mthd) / 4 + (n) - 1] = groups,
+
+static const uint16_t nv097_dirty[NV_METHOD_TABLE_SIZE] = {
+    NV097_STATE_GROUPS(NV_DIRTY_ENTRY)
+};
+
+/* Redundant state is dropped here so it never costs a revalidation */
+static void nv097_mthd_state(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                             uint32_t method, uint32_t param)
+{
+    if (regs[method / 4] != param) {
+        regs[method / 4] = param;
+        ctx->dirty |= nv097_dirty[method / 4];
+    }
+}
+
+static void nv097_mthd_ctxdma(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                              uint32_t method, uint32_t param)
+{
+    uint32_t old = regs[method / 4];
+    
+    nv_mthd_ctxdma(s, ctx, regs, method, param);
+    if (regs[method / 4] != old) {
+        ctx->dirty |= nv097_dirty[method / 4];
+    }
+}
+
+static inline float nv_f32(uint32_t bits)
+{
+    float f;
+    
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static void nv_f32_array(float *dst, const uint32_t *regs, unsigned n)
+{
+    unsigned i;
+    
+    for (i = 0; i < n; i++) {
+        dst[i] = nv_f32(regs[i]);
+    }
+}
+
+static unsigned nv097_color_bpp(uint32_t format)
+{
+    switch (format) {
+    case NV097_SURFACE_COLOR_B8:
+        return 1;
+    case NV097_SURFACE_COLOR_R5G6B5:
+    case NV097_SURFACE_COLOR_G8B8:
+        return 2;
+    case NV097_SURFACE_COLOR_X8R8G8B8_Z8:
+    case NV097_SURFACE_COLOR_X8R8G8B8_O8:
+    case NV097_SURFACE_COLOR_A8R8G8B8:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static void nv097_validate_surface(NVGFState *s, const uint32_t *regs,
+                                   NVSurfaceState *st)
+{
+    uint32_t format = regs[NV097_SET_SURFACE_FORMAT / 4];
+    uint32_t pitch = regs[NV097_SET_SURFACE_PITCH / 4];
+    uint32_t clip_h = regs[NV097_SET_SURFACE_CLIP_HORIZONTAL / 4];
+    uint32_t clip_v = regs[NV097_SET_SURFACE_CLIP_VERTICAL / 4];
+    
+    nv_dma_load(s, regs[NV097_SET_CONTEXT_DMA_COLOR / 4], &st->color_dma);
+    nv_dma_load(s, regs[NV097_SET_CONTEXT_DMA_ZETA / 4], &st->zeta_dma);
+    st->color_offset = regs[NV097_SET_SURFACE_COLOR_OFFSET / 4];
+    st->zeta_offset = regs[NV097_SET_SURFACE_ZETA_OFFSET / 4];
+    st->color_pitch = pitch & 0xffff;
+    st->zeta_pitch = pitch >> 16;
+    st->color_format = format & NV097_SURFACE_COLOR_MASK;
+    st->zeta_format = (format >> NV097_SURFACE_ZETA_SHIFT) & 0xf;
+    st->color_bpp = nv097_color_bpp(st->color_format);
+    st->zeta_bpp = st->zeta_format == NV097_SURFACE_ZETA_Z16 ? 2 :
+                   st->zeta_format == NV097_SURFACE_ZETA_Z24S8 ? 4 : 0;
+    st->swizzled = ((format >> NV097_SURFACE_TYPE_SHIFT) & 0xf) ==
+                   NV097_SURFACE_TYPE_SWIZZLE;
+    st->x = clip_h & 0xffff;
+    st->width = clip_h >> 16;
+    st->y = clip_v & 0xffff;
+    st->height = clip_v >> 16;
+    
+    /*
+     * D3D scissors with the first inclusive window clip rectangle.  Its
+     * bounds are inclusive; never written, it clips nothing.
+     */
+    clip_h = regs[NV097_SET_WINDOW_CLIP_HORIZONTAL / 4];
+    clip_v = regs[NV097_SET_WINDOW_CLIP_VERTICAL / 4];
+    if (regs[NV097_SET_WINDOW_CLIP_TYPE / 4] ==
+        NV097_WINDOW_CLIP_TYPE_INCLUSIVE && (clip_h || clip_v)) {
+        st->scissor[0] = clip_h & 0xfff;
+        st->scissor[1] = clip_v & 0xfff;
+        st->scissor[2] = ((clip_h >> 16) & 0xfff) + 1;
+        st->scissor[3] = ((clip_v >> 16) & 0xfff) + 1;
+    } else {
+        st->scissor[0] = st->scissor[1] = 0;
+        st->scissor[2] = st->scissor[3] = INT_MAX;
+    }
+}
+
+static void nv097_validate_blend(const uint32_t *regs, NVBlendState *st)
+{
+    uint32_t mask = regs[NV097_SET_COLOR_MASK / 4];
+    int i;
+    
+    st->blend = regs[NV097_SET_BLEND_ENABLE / 4] & 1;
+    st->sfactor = regs[NV097_SET_BLEND_FUNC_SFACTOR / 4];
+    st->dfactor = regs[NV097_SET_BLEND_FUNC_DFACTOR / 4];
+    st->equation = regs[NV097_SET_BLEND_EQUATION / 4];
+    st->color = regs[NV097_SET_BLEND_COLOR / 4];
+    st->alpha_test = regs[NV097_SET_ALPHA_TEST_ENABLE / 4] & 1;
+    st->alpha_func = regs[NV097_SET_ALPHA_FUNC / 4] & 7;
+    st->alpha_ref = regs[NV097_SET_ALPHA_REF / 4] & 0xff;
+    st->logic_op = regs[NV097_SET_LOGIC_OP_ENABLE / 4] & 1;
+    st->logic_opcode = regs[NV097_SET_LOGIC_OP / 4] & 0xf;
+    st->dither = regs[NV097_SET_DITHER_ENABLE / 4] & 1;
+    
+    /* One enable bit per channel, expanded to byte lanes */
+    st->write_mask = 0;
+    for (i = 0; i < 4; i++) {
+        if (mask & (1 << (i * 8))) {
+            st->write_mask |= 0xff << (i * 8);
+        }
+    }
+}
+
+static void nv097_validate_depth(const uint32_t *regs, NVDepthState *st)
+{
+    st->test = regs[NV097_SET_DEPTH_TEST_ENABLE / 4] & 1;
+    st->write = regs[NV097_SET_DEPTH_MASK / 4] & 1;
+    st->func = regs[NV097_SET_DEPTH_FUNC / 4] & 7;
+    st->stencil = regs[NV097_SET_STENCIL_TEST_ENABLE / 4] & 1;
+    st->stencil_func = regs[NV097_SET_STENCIL_FUNC / 4] & 7;
+    st->stencil_ref = regs[NV097_SET_STENCIL_FUNC_REF / 4] & 0xff;
+    st->stencil_mask = regs[NV097_SET_STENCIL_FUNC_MASK / 4] & 0xff;
+    st->stencil_write_mask = regs[NV097_SET_STENCIL_MASK / 4] & 0xff;
+    st->op_fail = regs[NV097_SET_STENCIL_OP_FAIL / 4];
+    st->op_zfail = regs[NV097_SET_STENCIL_OP_ZFAIL / 4];
+    st->op_zpass = regs[NV097_SET_STENCIL_OP_ZPASS / 4];
+    st->clip_min = nv_f32(regs[NV097_SET_CLIP_MIN / 4]);
+    st->clip_max = nv_f32(regs[NV097_SET_CLIP_MAX / 4]);
+    st->shadow_func = regs[NV097_SET_SHADOW_DEPTH_FUNC / 4] & 7;
+}
+
+static void nv097_validate_raster(const uint32_t *regs, NVRasterState *st)
+{
+    st->cull = regs[NV097_SET_CULL_FACE_ENABLE / 4] & 1;
+    st->cull_face = regs[NV097_SET_CULL_FACE / 4];
+    st->front_ccw = regs[NV097_SET_FRONT_FACE / 4] == NV097_FRONT_FACE_CCW;
+    st->front_mode = regs[NV097_SET_FRONT_POLYGON_MODE / 4];
+    st->back_mode = regs[NV097_SET_BACK_POLYGON_MODE / 4];
+    st->flat = regs[NV097_SET_SHADE_MODE / 4] == NV097_SHADE_MODE_FLAT;
+    st->z_perspective = regs[NV097_SET_CONTROL0 / 4] &
+                        NV097_CONTROL0_Z_PERSPECTIVE;
+    st->point_size = (regs[NV097_SET_POINT_SIZE / 4] & 0x1ff) / 8.0f;
+}
+
+static void nv097_validate_transform(const uint32_t *regs,
+                                     NVTransformState *st, NVTnLState *tnl)
+{
+    int i, j;
+    
+    st->program = (regs[NV097_SET_TRANSFORM_EXECUTION_MODE / 4] & 3) ==
+                  NV097_EXECUTION_MODE_PROGRAM;
+    nv_f32_array(st->viewport_scale, &regs[NV097_SET_VIEWPORT_SCALE / 4], 4);
+    
+    nv_f32_array(tnl->composite, &regs[NV097_SET_COMPOSITE_MATRIX / 4], 16);
+    nv_f32_array(tnl->modelview, &regs[NV097_SET_MODEL_VIEW_MATRIX / 4], 16);
+    nv_f32_array(tnl->inv_modelview,
+                 &regs[NV097_SET_INVERSE_MODEL_VIEW_MATRIX / 4], 16);
+    nv_f32_array(tnl->viewport_offset,
+                 &regs[NV097_SET_VIEWPORT_OFFSET / 4], 4);
+    
+    tnl->texgen = false;
+    for (i = 0; i < NV097_NUM_TEXTURES; i++) {
+        for (j = 0; j < 4; j++) {
+            tnl->texgen_mode[i][j] = regs[NV097_SET_TEXGEN_S / 4 + i * 4 + j];
+            nv_f32_array(tnl->texgen_plane[i][j],
+                         &regs[NV097_SET_TEXGEN_PLANE_S / 4 + i * 16 + j * 4],
+                         4);
+            tnl->texgen |= tnl->texgen_mode[i][j] != NV_TEXGEN_DISABLE;
+        }
+        tnl->texture_matrix_enable[i] =
+            regs[NV097_SET_TEXTURE_MATRIX_ENABLE / 4 + i] & 1;
+        nv_f32_array(tnl->texture_matrix[i],
+                     &regs[NV097_SET_TEXTURE_MATRIX / 4 + i * 16], 16);
+        tnl->texgen |= tnl->texture_matrix_enable[i];
+    }
+}
+
+/* Only infinite lights are modelled; local and spot lights act as such */
+static void nv097_validate_lighting(const uint32_t *regs, NVTnLState *tnl)
+{
+    uint32_t mask = regs[NV097_SET_LIGHT_ENABLE_MASK / 4];
+    const uint32_t *l;
+    NVLight *light;
+    int i;
+    
+    tnl->lighting = regs[NV097_SET_LIGHTING_ENABLE / 4] & 1;
+    tnl->normalize = regs[NV097_SET_NORMALIZATION_ENABLE / 4] & 1;
+    tnl->diffuse_from_vertex =
+        ((regs[NV097_SET_COLOR_MATERIAL / 4] >>
+          NV097_COLOR_MATERIAL_DIFFUSE_SHIFT) & 3) ==
+        NV097_COLOR_MATERIAL_FROM_DIFFUSE;
+    nv_f32_array(tnl->scene_ambient,
+                 &regs[NV097_SET_SCENE_AMBIENT_COLOR / 4], 3);
+    nv_f32_array(tnl->emission, &regs[NV097_SET_MATERIAL_EMISSION / 4], 3);
+    tnl->material_alpha = nv_f32(regs[NV097_SET_MATERIAL_ALPHA / 4]);
+    
+    tnl->num_lights = 0;
+    for (i = 0; i < NV_ENGINE_LIGHTS; i++) {
+        if (!((mask >> (i * 2)) & 3)) {
+            continue;
+        }
+        l = &regs[(NV097_SET_LIGHT + i * NV097_LIGHT_SIZE) / 4];
+        light = &tnl->light[tnl->num_lights++];
+        nv_f32_array(light->ambient, &l[NV097_LIGHT_AMBIENT_COLOR / 4], 3);
+        nv_f32_array(light->diffuse, &l[NV097_LIGHT_DIFFUSE_COLOR / 4], 3);
+        nv_f32_array(light->specular, &l[NV097_LIGHT_SPECULAR_COLOR / 4], 3);
+        nv_f32_array(light->half, &l[NV097_LIGHT_INFINITE_HALF_VECTOR / 4], 3);
+        nv_f32_array(light->dir, &l[NV097_LIGHT_INFINITE_DIRECTION / 4], 3);
+    }
+}
+
+/* Fold the fragment state groups into what the rasterizer consumes */
+static void nv097_update_rop(NVKelvinState *st)
+{
+    NVRasterOps *rop = &st->rop;
+    uint32_t face = st->raster.cull_face;
+    float max_depth = st->surface.zeta_bpp == 2 ? 0xffff : 0xffffff;
+    int i;
+    
+    rop->cull_front = st->raster.cull && (face == NV097_CULL_FACE_FRONT ||
+                                          face == NV097_CULL_FACE_FRONT_AND_BACK);
+    rop->cull_back = st->raster.cull && (face == NV097_CULL_FACE_BACK ||
+                                         face == NV097_CULL_FACE_FRONT_AND_BACK);
+    rop->front_ccw = st->raster.front_ccw;
+    rop->flat = st->raster.flat;
+    
+    rop->depth_test = st->depth.test;
+    rop->depth_write = st->depth.test && st->depth.write;
+    rop->depth_func = st->depth.func;
+    rop->depth_min = MAX(st->depth.clip_min, 0);
+    rop->depth_max = MIN(st->depth.clip_max, max_depth);
+    
+    rop->alpha_test = st->blend.alpha_test;
+    rop->alpha_func = st->blend.alpha_func;
+    rop->alpha_ref = st->blend.alpha_ref / 255.0f;
+    
+    rop->blend = st->blend.blend;
+    rop->sfactor = st->blend.sfactor;
+    rop->dfactor = st->blend.dfactor;
+    rop->equation = st->blend.equation;
+    for (i = 0; i < 3; i++) {
+        rop->blend_color[i] = ((st->blend.color >> (16 - i * 8)) & 0xff) /
+                              255.0f;
+    }
+    rop->blend_color[3] = (st->blend.color >> 24) / 255.0f;
+    rop->write_mask = st->blend.write_mask;
+}
+
+static void nv097_validate_vertex(NVGFState *s, const uint32_t *regs,
+                                  NVVertexState *st)
+{
+    NVVertexAttrib *a;
+    uint32_t format, offset;
+    int i;
+    
+    nv_dma_load(s, regs[NV097_SET_CONTEXT_DMA_VERTEX_A / 4], &st->dma_a);
+    nv_dma_load(s, regs[NV097_SET_CONTEXT_DMA_VERTEX_B / 4], &st->dma_b);
+    for (i = 0; i < NV097_NUM_ATTRIBS; i++) {
+        a = &st->attrib[i];
+        format = regs[NV097_SET_VERTEX_DATA_ARRAY_FORMAT / 4 + i];
+        offset = regs[NV097_SET_VERTEX_DATA_ARRAY_OFFSET / 4 + i];
+        a->type = format & NV097_VERTEX_TYPE_MASK;
+        a->count = (format >> NV097_VERTEX_SIZE_SHIFT) & 0xf;
+        if (a->count > 4) {
+            qemu_log_mask(LOG_GUEST_ERROR, "geforce3: vertex attribute %d "
+                          "with %u components, disabled\n", i, a->count);
+            a->count = 0;
+        }
+        a->stride = format >> NV097_VERTEX_STRIDE_SHIFT;
+        a->offset = offset & ~NV097_VERTEX_OFFSET_DMA_B;
+        a->dma = offset & NV097_VERTEX_OFFSET_DMA_B ? &st->dma_b : &st->dma_a;
+    }
+}
+
+static void nv097_validate_texture(NVGFState *s, const uint32_t *regs,
+                                   unsigned stage, NVTextureState *st)
+{
+    const uint32_t *t = &regs[(NV097_SET_TEXTURE_OFFSET +
+                               stage * NV097_SET_TEXTURE_STAGE_SIZE) / 4];
+    uint32_t format = t[(NV097_SET_TEXTURE_FORMAT -
+                         NV097_SET_TEXTURE_OFFSET) / 4];
+    uint32_t rect = t[(NV097_SET_TEXTURE_IMAGE_RECT -
+                       NV097_SET_TEXTURE_OFFSET) / 4];
+    uint32_t control1 = t[(NV097_SET_TEXTURE_CONTROL1 -
+                           NV097_SET_TEXTURE_OFFSET) / 4];
+    uint32_t control0 = t[(NV097_SET_TEXTURE_CONTROL0 -
+                           NV097_SET_TEXTURE_OFFSET) / 4];
+    
+    st->enabled = control0 & NV097_TEXTURE_CONTROL0_ENABLE;
+    if (!st->enabled) {
+        return;
+    }
+    
+    nv_dma_load(s, regs[format & NV097_TEXTURE_FORMAT_DMA_B ?
+                        NV097_SET_CONTEXT_DMA_B / 4 :
+                        NV097_SET_CONTEXT_DMA_A / 4], &st->dma);
+    st->offset = t[0];
+    st->cubemap = format & NV097_TEXTURE_FORMAT_CUBEMAP;
+    st->dims = (format >> NV097_TEXTURE_FORMAT_DIMS_SHIFT) & 0xf;
+    st->color_format = (format >> NV097_TEXTURE_FORMAT_COLOR_SHIFT) & 0xff;
+    st->levels = MAX((format >> NV097_TEXTURE_FORMAT_LEVELS_SHIFT) & 0xf, 1);
+    st->pitch = control1 >> 16;
+    if (st->pitch) {
+        /* Linear textures take their size from the image rect */
+        st->width = rect >> 16;
+        st->height = rect & 0xffff;
+        st->depth = 1;
+        st->levels = 1;
+    } else {
+        st->width = 1 << ((format >> NV097_TEXTURE_FORMAT_SIZE_U_SHIFT) & 0xf);
+        st->height = 1 << ((format >> NV097_TEXTURE_FORMAT_SIZE_V_SHIFT) &
+                           0xf);
+        st->depth = 1 << ((format >> NV097_TEXTURE_FORMAT_SIZE_P_SHIFT) & 0xf);
+    }
+    /* NV20 textures are at most 4096 texels in each direction */
+    st->width = MIN(st->width, NV097_TEXTURE_MAX_SIZE);
+    st->height = MIN(st->height, NV097_TEXTURE_MAX_SIZE);
+    st->depth = MIN(st->depth, NV097_TEXTURE_MAX_SIZE);
+    st->address = t[(NV097_SET_TEXTURE_ADDRESS - NV097_SET_TEXTURE_OFFSET) / 4];
+    st->filter = t[(NV097_SET_TEXTURE_FILTER - NV097_SET_TEXTURE_OFFSET) / 4];
+    st->border_color = t[(NV097_SET_TEXTURE_BORDER_COLOR -
+                          NV097_SET_TEXTURE_OFFSET) / 4];
+    /* LOD clamps are unsigned 4.8 fixed point */
+    st->min_lod = extract32(control0, NV097_TEXTURE_CONTROL0_MIN_LOD_SHIFT,
+                            12) / 256.0f;
+    st->max_lod = extract32(control0, NV097_TEXTURE_CONTROL0_MAX_LOD_SHIFT,
+                            12) / 256.0f;
+    st->max_aniso = 1 << extract32(control0,
+                                   NV097_TEXTURE_CONTROL0_LOG_MAX_ANISO_SHIFT,
+                                   2);
+}
+
+/* Rebuild the derived state of every group changed since the last draw */
+static void nv097_validate(NVGFState *s, NVGRContext *ctx)
+{
+    NVKelvinState *st = &ctx->state;
+    uint32_t dirty = ctx->dirty;
+    int i;
+    
+    if (!dirty) {
+        return;
+    }
+    ctx->dirty = 0;
+    
+    if (dirty & NV097_DIRTY_SURFACE) {
+        nv097_validate_surface(s, ctx->kelvin, &st->surface);
+    }
+    if (dirty & NV097_DIRTY_BLEND) {
+        nv097_validate_blend(ctx->kelvin, &st->blend);
+    }
+    if (dirty & NV097_DIRTY_DEPTH) {
+        nv097_validate_depth(ctx->kelvin, &st->depth);
+    }
+    if (dirty & NV097_DIRTY_RASTER) {
+        nv097_validate_raster(ctx->kelvin, &st->raster);
+    }
+    if (dirty & NV097_DIRTY_TRANSFORM) {
+        nv097_validate_transform(ctx->kelvin, &st->transform, &st->tnl);
+    }
+    if (dirty & NV097_DIRTY_LIGHTING) {
+        nv097_validate_lighting(ctx->kelvin, &st->tnl);
+    }
+    if (dirty & (NV097_DIRTY_SURFACE | NV097_DIRTY_BLEND |
+                 NV097_DIRTY_DEPTH | NV097_DIRTY_RASTER)) {
+        nv097_update_rop(st);
+    }
+    if (dirty & NV097_DIRTY_VERTEX) {
+        nv097_validate_vertex(s, ctx->kelvin, &st->vertex);
+    }
+    for (i = 0; i < NV097_NUM_TEXTURES; i++) {
+        if (dirty & (NV097_DIRTY_TEXTURE0 << i)) {
+            nv097_validate_texture(s, ctx->kelvin, i, &st->texture[i]);
+        }
+    }
+}
+
+/*
+ * Harvest the VGA dirty log for nv_pgraph_check_textures().  The log and
+ * the scanout registers belong to the display, so this runs under the BQL.
+ */
+static void nv_pgraph_dirty_bh(void *opaque)
+{
+    NVGFState *s = opaque;
+    NVPGRAPHState *pg = &s->pgraph;
+    VGACommonState *vga = &s->vga;
+    hwaddr vram = vga->vram_size;
+    
+    QEMU_LOCK_GUARD(&s->pfifo.lock);
+    if (!pg->dirty_pending) {
+        return;
+    }
+    pg->scanout = MIN((hwaddr)vga->start_addr * 4, vram);
+    pg->scanout_end = MIN(pg->scanout +
+                          (hwaddr)vga->line_offset * vga->last_height, vram);
+    if (pg->scanout == pg->scanout_end) {
+        pg->scanout = pg->scanout_end = vram;
+    }
+    if (pg->scanout) {
+        pg->below = memory_region_snapshot_and_clear_dirty(&vga->vram, 0,
+                                                           pg->scanout,
+                                                           DIRTY_MEMORY_VGA);
+    }
+    if (pg->scanout_end < vram) {
+        pg->above = memory_region_snapshot_and_clear_dirty(
+            &vga->vram, pg->scanout_end, vram - pg->scanout_end,
+            DIRTY_MEMORY_VGA);
+    }
+    pg->dirty_pending = false;
+    pg->dirty_done = true;
+    qemu_cond_broadcast(&pg->dirty_cond);
+}
+
+/*
+ * Mark the texture bindings whose VRAM may have changed since the last
+ * draw.  Engine writes mark them as they happen.  CPU writes through the
+ * BAR land in the VGA dirty bitmap, which is only harvested when the CPU
+ * can have written since the last harvest: a doorbell or a semaphore
+ * release came in between.  Every binding is tested against the same
+ * snapshot, so bindings sharing pages all see a write.  The display
+ * consumes the bits of the pages it scans out by itself, bindings there
+ * always count as changed.  If the BQL holder is waiting for the PFIFO
+ * thread, the harvest is abandoned and every binding counts as changed.
+ */
+static void nv_pgraph_check_textures(NVGFState *s)
+{
+    NVPFIFOState *f = &s->pfifo;
+    NVPGRAPHState *pg = &s->pgraph;
+    MemoryRegion *vram = &s->vga.vram;
+    NVTexBinding *b;
+    hwaddr start, end;
+    uint32_t kicks;
+    bool done;
+    int i;
+    
+    for (i = 0; i < NV_TEX_BINDINGS; i++) {
+        if (pg->tex[i].entry && !pg->tex[i].stale) {
+            break;
+        }
+    }
+    if (i == NV_TEX_BINDINGS) {
+        return;
+    }
+    kicks = qatomic_read(&f->kicks);
+    if (kicks == pg->dirty_kicks && !pg->dirty_sync) {
+        return;
+    }
+    
+    WITH_QEMU_LOCK_GUARD(&f->lock) {
+        pg->dirty_pending = true;
+        pg->dirty_done = false;
+        qemu_bh_schedule(pg->dirty_bh);
+        while (!pg->dirty_done && !f->preempt && !f->stop) {
+            qemu_cond_wait(&pg->dirty_cond, &f->lock);
+        }
+        done = pg->dirty_done;
+        pg->dirty_pending = false;
+        pg->dirty_done = false;
+    }
+    
+    for (i = 0; i < NV_TEX_BINDINGS; i++) {
+        b = &pg->tex[i];
+        if (!b->entry || b->stale) {
+            continue;
+        }
+        end = b->addr + b->len;
+        if (!done || (b->addr < pg->scanout_end && end > pg->scanout)) {
+            b->stale = true;
+            continue;
+        }
+        if (pg->below && b->addr < pg->scanout) {
+            b->stale |= memory_region_snapshot_get_dirty(
+                vram, pg->below, b->addr, MIN(end, pg->scanout) - b->addr);
+        }
+        if (pg->above && end > pg->scanout_end) {
+            start = MAX(b->addr, pg->scanout_end);
+            b->stale |= memory_region_snapshot_get_dirty(vram, pg->above,
+                                                         start, end - start);
+        }
+    }
+    if (done) {
+        pg->dirty_kicks = kicks;
+        pg->dirty_sync = false;
+    }
+    g_free(pg->below);
+    g_free(pg->above);
+    pg->below = pg->above = NULL;
+}
+
+/* Guest image of texture @t, false for formats that can't be decoded */
+static bool nv097_texture_image(const NVTextureState *t, NVTextureImage *img)
+{
+    switch (t->color_format) {
+    case NV097_TEXTURE_COLOR_SZ_Y8:
+    case NV097_TEXTURE_COLOR_LU_Y8:
+        img->format = NV_TEXEL_L8;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_AY8:
+        img->format = NV_TEXEL_AL8;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_A8:
+        img->format = NV_TEXEL_A8;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_A1R5G5B5:
+    case NV097_TEXTURE_COLOR_LU_A1R5G5B5:
+        img->format = NV_TEXEL_A1R5G5B5;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_X1R5G5B5:
+    case NV097_TEXTURE_COLOR_LU_X1R5G5B5:
+        img->format = NV_TEXEL_X1R5G5B5;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_A4R4G4B4:
+    case NV097_TEXTURE_COLOR_LU_A4R4G4B4:
+        img->format = NV_TEXEL_A4R4G4B4;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_R5G6B5:
+    case NV097_TEXTURE_COLOR_LU_R5G6B5:
+        img->format = NV_TEXEL_R5G6B5;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_A8R8G8B8:
+    case NV097_TEXTURE_COLOR_LU_A8R8G8B8:
+        img->format = NV_TEXEL_A8R8G8B8;
+        break;
+    case NV097_TEXTURE_COLOR_SZ_X8R8G8B8:
+    case NV097_TEXTURE_COLOR_LU_X8R8G8B8:
+        img->format = NV_TEXEL_X8R8G8B8;
+        break;
+    case NV097_TEXTURE_COLOR_LU_DEPTH_Y16:
+        img->format = NV_TEXEL_R16;
+        break;
+    case NV097_TEXTURE_COLOR_LU_DEPTH_X8_Y24:
+        img->format = NV_TEXEL_R32;
+        break;
+    default:
+        return false;
+    }
+    img->swizzled = t->color_format < NV097_TEXTURE_COLOR_LU_A1R5G5B5 ||
+                   t->color_format == NV097_TEXTURE_COLOR_SZ_A8;
+    img->width = t->width;
+    img->height = t->height;
+    img->levels = t->levels;
+    img->pitch = t->pitch;
+    return true;
+}
+
+/* Hash the texture data and decode it unless the content is known */
+static NVCacheEntry *nv097_texture_load(NVGFState *s, const NVTextureState *t,
+                                        const NVTextureImage *img,
+                                        uint64_t desc, hwaddr len)
+{
+    g_autofree uint8_t *bounce = NULL;
+    const uint8_t *raw;
+    NVDMAMapping m;
+    NVCacheEntry *e;
+    uint32_t *texels;
+    uint64_t key;
+    size_t size;
+    
+    raw = nv_dma_map(s, &t->dma, t->offset, len, false, &m);
+    if (!raw) {
+        bounce = g_malloc(len);
+        if (!nv_dma_read(s, &t->dma, t->offset, bounce, len)) {
+            return NULL;
+        }
+        raw = bounce;
+    }
+    
+    key = nv_hash64(raw, len, desc);
+    e = nv_cache_lookup(s->cache, NV_CACHE_TEXTURE, key,
+                        nv_texture_decoded_size(img));
+    if (!e) {
+        texels = nv_texture_decode(img, raw, &size);
+        e = nv_cache_insert(s->cache, NV_CACHE_TEXTURE, key, texels, size);
+    }
+    nv_dma_unmap(s, &m);
+    return e;
+}
+
+/*
+ * Decoded image of texture @t, with a reference for the caller.  Textures
+ * in VRAM stay bound to their decoded image until the VRAM dirty bitmap
+ * shows a write to their pages, so unchanged textures are neither hashed
+ * nor decoded again.  Anywhere else there is no dirty tracking and the
+ * data is hashed on every use.
+ */
+static NVCacheEntry *nv097_texture_get(NVGFState *s, const NVTextureState *t)
+{
+    NVPGRAPHState *pg = &s->pgraph;
+    NVTexBinding *b, *victim = &pg->tex[0];
+    uint32_t key[5] = { t->color_format, t->width, t->height, t->levels,
+                        t->pitch };
+    uint64_t desc = nv_hash64(key, sizeof(key), 0);
+    hwaddr addr = t->dma.address + t->offset;
+    NVTextureImage img;
+    unsigned i;
+    hwaddr len;
+    
+    if (!nv097_texture_image(t, &img) || t->cubemap || t->dims != 2) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: texture format 0x%x not "
+                      "supported\n", t->color_format);
+        return NULL;
+    }
+    if (!img.swizzled &&
+        (uint64_t)img.width * nv_texel_size(img.format) > img.pitch) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: texture rows of %u texels "
+                      "wider than their pitch of %u bytes\n", img.width,
+                      img.pitch);
+        return NULL;
+    }
+    len = nv_texture_image_size(&img);
+    if (!nv_dma_check(s, &t->dma, t->offset, len)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: texture outside its DMA "
+                      "object\n");
+        return NULL;
+    }
+    if (!nv_dma_is_vram(&t->dma)) {
+        return nv097_texture_load(s, t, &img, desc, len);
+    }
+    
+    for (i = 0; i < NV_TEX_BINDINGS; i++) {
+        b = &pg->tex[i];
+        if (b->entry && b->desc == desc && b->addr == addr) {
+            break;
+        }
+        if (!b->entry || (victim->entry && b->used < victim->used)) {
+            victim = b;
+        }
+    }
+    if (i == NV_TEX_BINDINGS) {
+        b = victim;
+    }
+    
+    b->used = ++pg->tex_clock;
+    if (i < NV_TEX_BINDINGS && !b->stale) {
+        return nv_cache_entry_ref(b->entry);
+    }
+    
+    nv_cache_entry_unref(b->entry);
+    b->stale = false;
+    b->desc = desc;
+    b->addr = addr;
+    b->len = len;
+    b->entry = nv097_texture_load(s, t, &img, desc, len);
+    return b->entry ? nv_cache_entry_ref(b->entry) : NULL;
+}
+
+static void nv_pgraph_release_textures(NVGFState *s)
+{
+    int i;
+    
+    for (i = 0; i < NV_TEX_BINDINGS; i++) {
+        nv_cache_entry_unref(s->pgraph.tex[i].entry);
+        s->pgraph.tex[i].entry = NULL;
+    }
+}
+
+static void nv097_bind_texture(const NVTextureState *t,
+                               const uint32_t *texels, NVTexture *tex)
+{
+    uint32_t offset = 0;
+    unsigned i;
+    
+    tex->texels = texels;
+    tex->stride = t->width;
+    tex->force = 0;
+    tex->width = t->width;
+    tex->height = t->height;
+    tex->levels = t->pitch ? 1 : t->levels;
+    tex->normalized = !t->pitch;
+    tex->wrap_u = (t->address >> NV097_TEXTURE_ADDRESS_U_SHIFT) & 0xf;
+    tex->wrap_v = (t->address >> NV097_TEXTURE_ADDRESS_V_SHIFT) & 0xf;
+    tex->border = t->border_color;
+    tex->min_filter = extract32(t->filter, NV097_TEXTURE_FILTER_MIN_SHIFT, 8);
+    tex->mag_filter = extract32(t->filter, NV097_TEXTURE_FILTER_MAG_SHIFT, 4);
+    /* Signed 5.8 fixed point */
+    tex->lod_bias = sextract32(t->filter, 0,
+                               NV097_TEXTURE_FILTER_LOD_BIAS_BITS) / 256.0f;
+    tex->min_lod = t->min_lod;
+    tex->max_lod = MIN(t->max_lod, tex->levels - 1);
+    tex->max_aniso = t->max_aniso;
+    /* Depth formats hold raw zeta values, sampled with a comparison */
+    tex->shadow = t->color_format == NV097_TEXTURE_COLOR_LU_DEPTH_X8_Y24 ||
+                  t->color_format == NV097_TEXTURE_COLOR_LU_DEPTH_Y16;
+    if (t->color_format == NV097_TEXTURE_COLOR_LU_DEPTH_X8_Y24) {
+        tex->depth_shift = 8;
+        tex->depth_max = 0xffffff;
+    } else {
+        tex->depth_shift = 0;
+        tex->depth_max = 0xffff;
+    }
+    for (i = 0; i < tex->levels; i++) {
+        tex->level_offset[i] = offset;
+        offset += MAX(t->width >> i, 1) * MAX(t->height >> i, 1);
+    }
+}
+
+/* Remember that the color or zeta surface at @addr was rendered to */
+static void nv_pgraph_tag_surface(NVGFState *s, hwaddr addr, uint32_t pitch,
+                                  unsigned bpp)
+{
+    NVPGRAPHState *pg = &s->pgraph;
+    NVSurfaceTag *tag = &pg->surface_tag[0];
+    int i;
+    
+    for (i = 0; i < NV_SURFACE_TAGS; i++) {
+        if (pg->surface_tag[i].addr == addr) {
+            tag = &pg->surface_tag[i];
+            break;
+        }
+        if (pg->surface_tag[i].used < tag->used) {
+            tag = &pg->surface_tag[i];
+        }
+    }
+    tag->addr = addr;
+    tag->pitch = pitch;
+    tag->bpp = bpp;
+    tag->used = ++pg->surface_clock;
+}
+
+/*
+ * Render to texture: a linear 32-bit texture over a surface PGRAPH
+ * rendered to already is A8R8G8B8 (or Z24S8 for a shadow map) in VRAM,
+ * so it is sampled in place instead of being hashed and converted after
+ * every pass.
+ */
+static bool nv097_texture_alias(NVGFState *s, const NVTextureState *t,
+                                NVTexture *tex)
+{
+    hwaddr addr = t->dma.address + t->offset;
+    const NVSurfaceTag *tag = NULL;
+    NVTextureImage img;
+    int i;
+    
+    if (HOST_BIG_ENDIAN || !nv_dma_is_vram(&t->dma) || (addr & 3) ||
+        !nv097_texture_image(t, &img) || nv_texel_size(img.format) != 4 ||
+        img.swizzled) {
+        return false;
+    }
+    for (i = 0; i < NV_SURFACE_TAGS; i++) {
+        if (s->pgraph.surface_tag[i].used &&
+            s->pgraph.surface_tag[i].addr == addr) {
+            tag = &s->pgraph.surface_tag[i];
+            break;
+        }
+    }
+    if (!tag || tag->bpp != 4 || tag->pitch != t->pitch ||
+        t->width * 4 > t->pitch ||
+        !nv_dma_check(s, &t->dma, t->offset, (hwaddr)t->pitch * t->height)) {
+        return false;
+    }
+    
+    nv097_bind_texture(t, (const uint32_t *)(s->vga.vram_ptr + addr), tex);
+    tex->stride = t->pitch / 4;
+    if (t->color_format == NV097_TEXTURE_COLOR_LU_X8R8G8B8) {
+        tex->force = 0xff000000;
+    }
+    return true;
+}
+
+/* Vertex arrays of one draw, resolved to host memory */
+typedef struct NVDrawStreams {
+    NVAttribStream attrib[NV_ENGINE_ATTRIBS];
+    NVDMAMapping map[NV_ENGINE_ATTRIBS];
+    uint32_t *index;            /* per vertex, relative to each stream */
+    unsigned count;
+    uint32_t *elt;              /* vertex of each element of the draw */
+    unsigned elements;
+} NVDrawStreams;
+
+/* 1.0f in little endian, the default for w and for diffuse */
+static const uint8_t nv_attrib_one[16] = {
+    0x00, 0x00, 0x80, 0x3f, 0x00, 0x00, 0x80, 0x3f,
+    0x00, 0x00, 0x80, 0x3f, 0x00, 0x00, 0x80, 0x3f,
+};
+
+static void nv097_default_stream(unsigned slot, NVAttribStream *a)
+{
+    a->base = nv_attrib_one;
+    a->stride = 0;
+    a->type = NV_ATTRIB_F;
+    a->count = slot == NV_ATTR_DIFFUSE ? 4 : 0;
+}
+
+/* INLINE_ARRAY data is the enabled attributes packed vertex by vertex */
+static bool nv097_inline_streams(NVGRContext *ctx, NVDrawStreams *d)
+{
+    const NVVertexState *vtx = &ctx->state.vertex;
+    unsigned stride = 0, offset = 0, size, i;
+    
+    for (i = 0; i < NV097_NUM_ATTRIBS; i++) {
+        if (vtx->attrib[i].count) {
+            stride += nv_attrib_size(vtx->attrib[i].type,
+                                     vtx->attrib[i].count);
+        }
+    }
+    if (!stride) {
+        return false;
+    }
+    
+    d->count = ctx->inline_array->len / stride;
+    d->elements = d->count;
+    d->index = g_new(uint32_t, d->count);
+    d->elt = g_new(uint32_t, d->count);
+    for (i = 0; i < d->count; i++) {
+        d->index[i] = d->elt[i] = i;
+    }
+    for (i = 0; i < NV097_NUM_ATTRIBS; i++) {
+        const NVVertexAttrib *a = &vtx->attrib[i];
+        
+        if (!a->count) {
+            nv097_default_stream(i, &d->attrib[i]);
+            continue;
+        }
+        size = nv_attrib_size(a->type, a->count);
+        d->attrib[i].base = ctx->inline_array->data + offset;
+        d->attrib[i].stride = stride;
+        d->attrib[i].type = a->type;
+        d->attrib[i].count = a->count;
+        offset += size;
+    }
+    return true;
+}
+
+/*
+ * Indexed draws reference most vertices several times.  Like the hardware's
+ * post-transform cache, look each index up before transforming it, but with
+ * as many entries as the vertex-cache property asks for.
+ */
+static void nv097_vertex_cache(NVGFState *s, NVGRContext *ctx,
+                               const uint32_t *index, uint32_t min,
+                               NVDrawStreams *d)
+{
+    uint32_t mask = s->vertex_cache - 1;
+    NVVertexCacheEntry *e;
+    unsigned i;
+    
+    if (!ctx->vcache) {
+        ctx->vcache = g_new0(NVVertexCacheEntry, s->vertex_cache);
+    }
+    if (++ctx->vcache_draw == 0) {
+        memset(ctx->vcache, 0, s->vertex_cache * sizeof(*ctx->vcache));
+        ctx->vcache_draw = 1;
+    }
+    
+    d->count = 0;
+    for (i = 0; i < d->elements; i++) {
+        e = &ctx->vcache[index[i] & mask];
+        if (e->draw != ctx->vcache_draw || e->index != index[i]) {
+            e->index = index[i];
+            e->vertex = d->count;
+            e->draw = ctx->vcache_draw;
+            d->index[d->count++] = index[i] - min;
+        }
+        d->elt[i] = e->vertex;
+    }
+}
+
+/* Map the span of every enabled array that the draw's indices touch */
+static bool nv097_array_streams(NVGFState *s, NVGRContext *ctx,
+                                NVDrawStreams *d)
+{
+    const NVVertexState *vtx = &ctx->state.vertex;
+    const uint32_t *index = (uint32_t *)ctx->draw_index->data;
+    uint32_t min = UINT32_MAX, max = 0;
+    unsigned size, i;
+    
+    d->elements = ctx->draw_index->len;
+    for (i = 0; i < d->elements; i++) {
+        min = MIN(min, index[i]);
+        max = MAX(max, index[i]);
+    }
+    d->index = g_new(uint32_t, d->elements);
+    d->elt = g_new(uint32_t, d->elements);
+    nv097_vertex_cache(s, ctx, index, min, d);
+    
+    for (i = 0; i < NV097_NUM_ATTRIBS; i++) {
+        const NVVertexAttrib *a = &vtx->attrib[i];
+        
+        if (!a->count) {
+            nv097_default_stream(i, &d->attrib[i]);
+            continue;
+        }
+        size = nv_attrib_size(a->type, a->count);
+        d->attrib[i].base = nv_dma_map(s, a->dma,
+                                       a->offset + min * a->stride,
+                                       (hwaddr)(max - min) * a->stride + size,
+                                       false, &d->map[i]);
+        if (!size || !d->attrib[i].base) {
+            qemu_log_mask(LOG_GUEST_ERROR, "geforce3: vertex array %u "
+                          "outside its DMA object\n", i);
+            return false;
+        }
+        d->attrib[i].stride = a->stride;
+        d->attrib[i].type = a->type;
+        d->attrib[i].count = a->count;
+    }
+    return true;
+}
+
+static void nv097_release_streams(NVGFState *s, NVDrawStreams *d)
+{
+    int i;
+    
+    for (i = 0; i < NV_ENGINE_ATTRIBS; i++) {
+        nv_dma_unmap(s, &d->map[i]);
+    }
+    g_free(d->index);
+    g_free(d->elt);
+}
+
+/* Fetch and transform every vertex of the draw, NV_ENGINE_BATCH at a time */
+static void nv097_transform(const NVTnLState *tnl, const NVDrawStreams *d,
+                            NVVertex *out)
+{
+    static const uint32_t zero_index[NV_ENGINE_BATCH];
+    NVTnLFn *fn = nv_tnl_select(tnl);
+    NVAttribBatch batch;
+    bool enabled[NV_ENGINE_ATTRIBS];
+    unsigned i, a;
+    
+    /* Disabled attributes are constant, fill them in once */
+    for (a = 0; a < NV_ENGINE_ATTRIBS; a++) {
+        enabled[a] = d->attrib[a].stride != 0;
+        if (!enabled[a]) {
+            nv_fetch_attrib(&d->attrib[a], zero_index, NV_ENGINE_BATCH,
+                            batch.v[a]);
+        }
+    }
+    
+    for (i = 0; i < d->count; i += NV_ENGINE_BATCH) {
+        batch.count = MIN(d->count - i, NV_ENGINE_BATCH);
+        for (a = 0; a < NV_ENGINE_ATTRIBS; a++) {
+            if (enabled[a]) {
+                nv_fetch_attrib(&d->attrib[a], &d->index[i], batch.count,
+                                batch.v[a]);
+            }
+        }
+        fn(tnl, &batch, &out[i]);
+    }
+}
+
+/* Split primitive @mode into triangles, as vertex index triples */
+static unsigned nv097_assemble(uint32_t mode, const uint32_t *elt,
+                               unsigned n, uint32_t (*prim)[3])
+{
+    unsigned i, count = 0;
+    
+#define NV_EMIT(a, b, c) \
+    do { \
+        prim[count][0] = elt[a]; \
+        prim[count][1] = elt[b]; \
+        prim[count][2] = elt[c]; \
+        count++; \
+    } while (0)
+    
+    switch (mode) {
+    case NV097_BEGIN_END_TRIANGLES:
+        for (i = 0; i + 2 < n; i += 3) {
+            NV_EMIT(i, i + 1, i + 2);
+        }
+        break;
+    case NV097_BEGIN_END_TRIANGLE_STRIP:
+        for (i = 2; i < n; i++) {
+            if (i & 1) {
+                NV_EMIT(i - 1, i - 2, i);
+            } else {
+                NV_EMIT(i - 2, i - 1, i);
+            }
+        }
+        break;
+    case NV097_BEGIN_END_TRIANGLE_FAN:
+    case NV097_BEGIN_END_POLYGON:
+        for (i = 2; i < n; i++) {
+            NV_EMIT(0, i - 1, i);
+        }
+        break;
+    case NV097_BEGIN_END_QUADS:
+        for (i = 0; i + 3 < n; i += 4) {
+            NV_EMIT(i, i + 1, i + 2);
+            NV_EMIT(i, i + 2, i + 3);
+        }
+        break;
+    case NV097_BEGIN_END_QUAD_STRIP:
+        for (i = 0; i + 3 < n; i += 2) {
+            NV_EMIT(i, i + 1, i + 3);
+            NV_EMIT(i, i + 3, i + 2);
+        }
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP, "geforce3: primitive %u not supported\n",
+                      mode);
+        break;
+    }
+#undef NV_EMIT
+    return count;
+}
+
+typedef struct NVTileJob {
+    NVRenderJob job;
+    const NVRenderTarget *rt;
+    const NVRasterOps *ops;
+    const NVTriangle *tris;
+    const uint32_t *list;
+    unsigned n;
+    unsigned tx, ty;
+    unsigned passed;
+} NVTileJob;
+
+static void nv_tile_job(void *opaque)
+{
+    NVTileJob *t = opaque;
+    
+    t->passed = nv_raster_tile(t->rt, t->ops, t->tris, t->list, t->n,
+                               t->tx, t->ty);
+}
+
+/*
+ * Bin the triangles into screen tiles and rasterize the tiles on the
+ * render pool.  Each tile keeps the submission order of its triangles.
+ * Returns the number of fragments written.
+ */
+static uint32_t nv097_raster(NVGFState *s, const NVRenderTarget *rt,
+                             const NVRasterOps *ops, const NVTriangle *tris,
+                             unsigned count)
+{
+    unsigned tiles_x = DIV_ROUND_UP(rt->x1, NV_TILE_SIZE);
+    unsigned tiles_y = DIV_ROUND_UP(rt->y1, NV_TILE_SIZE);
+    unsigned ntiles = tiles_x * tiles_y;
+    g_autofree uint32_t *first = g_new0(uint32_t, ntiles + 1);
+    g_autofree uint32_t *fill = NULL;
+    g_autofree uint32_t *list = NULL;
+    g_autofree NVTileJob *jobs = NULL;
+    NVRenderBatch batch;
+    unsigned i, tx, ty, tile, njobs = 0;
+    uint32_t passed = 0;
+    
+    /* Count, prefix sum, then fill the per-tile triangle lists */
+    for (i = 0; i < count; i++) {
+        const NVTriangle *t = &tris[i];
+        
+        for (ty = t->y0 >> NV_TILE_SHIFT;
+             ty <= (t->y1 - 1) >> NV_TILE_SHIFT; ty++) {
+            for (tx = t->x0 >> NV_TILE_SHIFT;
+                 tx <= (t->x1 - 1) >> NV_TILE_SHIFT; tx++) {
+                first[ty * tiles_x + tx + 1]++;
+            }
+        }
+    }
+    for (tile = 0; tile < ntiles; tile++) {
+        njobs += first[tile + 1] != 0;
+        first[tile + 1] += first[tile];
+    }
+    list = g_new(uint32_t, first[ntiles]);
+    fill = g_memdup2(first, ntiles * sizeof(*first));
+    for (i = 0; i < count; i++) {
+        const NVTriangle *t = &tris[i];
+        
+        for (ty = t->y0 >> NV_TILE_SHIFT;
+             ty <= (t->y1 - 1) >> NV_TILE_SHIFT; ty++) {
+            for (tx = t->x0 >> NV_TILE_SHIFT;
+                 tx <= (t->x1 - 1) >> NV_TILE_SHIFT; tx++) {
+                list[fill[ty * tiles_x + tx]++] = i;
+            }
+        }
+    }
+    
+    jobs = g_new(NVTileJob, njobs);
+    nv_render_batch_init(&batch, s->render);
+    for (tile = 0, i = 0; tile < ntiles; tile++) {
+        if (first[tile + 1] == first[tile]) {
+            continue;
+        }
+        jobs[i] = (NVTileJob) {
+            .job.fn = nv_tile_job,
+            .job.opaque = &jobs[i],
+            .job.cost = first[tile + 1] - first[tile],
+            .rt = rt,
+            .ops = ops,
+            .tris = tris,
+            .list = &list[first[tile]],
+            .n = first[tile + 1] - first[tile],
+            .tx = tile % tiles_x,
+            .ty = tile / tiles_x,
+        };
+        nv_render_submit(&batch, &jobs[i++].job);
+    }
+    nv_render_batch_wait(&batch);
+    nv_render_batch_destroy(&batch);
+    for (i = 0; i < njobs; i++) {
+        passed += jobs[i].passed;
+    }
+    return passed;
+}
+
+/* Fixed function draw of everything since BEGIN, run at END */
+static void nv097_draw(NVGFState *s, NVGRContext *ctx)
+{
+    NVKelvinState *st = &ctx->state;
+    const NVSurfaceState *surf = &st->surface;
+    NVDrawStreams d = { };
+    NVRenderTarget rt = { };
+    NVRasterOps ops = st->rop;
+    NVCacheEntry *images[NV097_NUM_TEXTURES] = { };
+    NVDMAMapping mcolor = { }, mzeta = { };
+    g_autofree NVVertex *verts = NULL;
+    g_autofree NVTriangle *tris = NULL;
+    g_autofree uint32_t (*prim)[3] = NULL;
+    unsigned count, i;
+    uint32_t passed;
+    bool ok;
+    
+    if (st->transform.program) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: vertex programs not supported\n");
+        return;
+    }
+    if (surf->swizzled || (surf->color_bpp != 2 && surf->color_bpp != 4)) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: surface format 0x%x not "
+                      "supported\n", surf->color_format);
+        return;
+    }
+    
+    if (ctx->inline_array && ctx->inline_array->len) {
+        ok = nv097_inline_streams(ctx, &d);
+    } else if (ctx->draw_index && ctx->draw_index->len) {
+        ok = nv097_array_streams(s, ctx, &d);
+    } else {
+        return;
+    }
+    if (!ok || d.elements < 3) {
+        goto out;
+    }
+    
+    verts = g_new(NVVertex, ROUND_UP(d.count, NV_ENGINE_BATCH));
+    nv097_transform(&st->tnl, &d, verts);
+    
+    rt.x0 = surf->x;
+    rt.y0 = surf->y;
+    rt.x1 = surf->x + surf->width;
+    rt.y1 = surf->y + surf->height;
+    rt.color_pitch = surf->color_pitch;
+    rt.color_bpp = surf->color_bpp;
+    rt.color = nv_dma_map(s, &surf->color_dma, surf->color_offset,
+                          (hwaddr)surf->color_pitch * rt.y1, true, &mcolor);
+    if (!rt.color || rt.x1 * rt.color_bpp > rt.color_pitch) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: color surface outside "
+                      "its DMA object\n");
+        goto out;
+    }
+    if (surf->zeta_bpp && st->depth.test) {
+        rt.zeta_pitch = surf->zeta_pitch;
+        rt.zeta_bpp = surf->zeta_bpp;
+        rt.zeta = nv_dma_map(s, &surf->zeta_dma, surf->zeta_offset,
+                             (hwaddr)surf->zeta_pitch * rt.y1, true, &mzeta);
+        if (!rt.zeta || rt.x1 * rt.zeta_bpp > rt.zeta_pitch) {
+            qemu_log_mask(LOG_GUEST_ERROR, "geforce3: zeta surface outside "
+                          "its DMA object\n");
+            goto out;
+        }
+    }
+    
+    /* The surfaces stay mapped whole, only drawing is scissored */
+    rt.x0 = MAX(rt.x0, surf->scissor[0]);
+    rt.y0 = MAX(rt.y0, surf->scissor[1]);
+    rt.x1 = MIN(rt.x1, surf->scissor[2]);
+    rt.y1 = MIN(rt.y1, surf->scissor[3]);
+    
+    /*
+     * Cull before anything else, so geometry that is entirely culled
+     * or off screen doesn't even load its textures.  A strip or fan of
+     * n vertices makes at most 2n triangles.
+     */
+    prim = g_malloc_n(d.elements * 2, sizeof(*prim));
+    count = nv097_assemble(ctx->primitive, d.elt, d.elements, prim);
+    tris = g_new(NVTriangle, MAX(count, 1));
+    count = nv_setup_triangles(tris, verts, prim, count, &rt, &ops);
+    if (!count) {
+        goto out;
+    }
+    
+    nv_pgraph_check_textures(s);
+    for (i = 0; i < NV097_NUM_TEXTURES; i++) {
+        if (!st->texture[i].enabled ||
+            nv097_texture_alias(s, &st->texture[i], &ops.tex[i])) {
+            continue;
+        }
+        images[i] = nv097_texture_get(s, &st->texture[i]);
+        if (images[i]) {
+            nv097_bind_texture(&st->texture[i], images[i]->data, &ops.tex[i]);
+        }
+    }
+    for (i = 0; i < NV097_NUM_TEXTURES; i++) {
+        ops.tex[i].shadow_func = st->depth.shadow_func;
+    }
+    
+    passed = nv097_raster(s, &rt, &ops, tris, count);
+    if (ctx->kelvin[NV097_SET_ZPASS_PIXEL_COUNT_ENABLE / 4] & 1) {
+        ctx->zpass_pixels += passed;
+    }
+    if (nv_dma_is_vram(&surf->color_dma)) {
+        nv_pgraph_tag_surface(s, surf->color_dma.address +
+                              surf->color_offset, surf->color_pitch,
+                              surf->color_bpp);
+    }
+    /* A depth pass may be sampled as a shadow map next */
+    if (rt.zeta && ops.depth_write && nv_dma_is_vram(&surf->zeta_dma)) {
+        nv_pgraph_tag_surface(s, surf->zeta_dma.address +
+                              surf->zeta_offset, surf->zeta_pitch,
+                              surf->zeta_bpp);
+    }
+    
+out:
+    for (i = 0; i < NV097_NUM_TEXTURES; i++) {
+        nv_cache_entry_unref(images[i]);
+    }
+    nv_dma_unmap(s, &mzeta);
+    nv_dma_unmap(s, &mcolor);
+    nv097_release_streams(s, &d);
+}
+
+static void nv097_set_begin_end(NVGFState *s, NVGRContext *ctx,
+                                uint32_t *regs, uint32_t method,
+                                uint32_t param)
+{
+    regs[method / 4] = param;
+    if (param == NV097_BEGIN_END_END) {
+        nv097_draw(s, ctx);
+        return;
+    }
+    
+    nv097_validate(s, ctx);
+    ctx->primitive = param;
+    if (ctx->inline_array) {
+        g_byte_array_set_size(ctx->inline_array, 0);
+    }
+    if (ctx->draw_index) {
+        g_array_set_size(ctx->draw_index, 0);
+    }
+    ctx->draw_overflow = false;
+}
+
+/* True if @len more units fit below @max, else drop them, logging once */
+static bool nv097_draw_fits(NVGRContext *ctx, size_t used, size_t len,
+                            size_t max)
+{
+    if (used + len <= max) {
+        return true;
+    }
+    if (!ctx->draw_overflow) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: draw too large, vertex "
+                      "data dropped\n");
+        ctx->draw_overflow = true;
+    }
+    return false;
+}
+
+static void nv097_push_index(NVGRContext *ctx, uint32_t index)
+{
+    if (!ctx->draw_index) {
+        ctx->draw_index = g_array_new(false, false, sizeof(uint32_t));
+    }
+    if (nv097_draw_fits(ctx, ctx->draw_index->len, 1,
+                        NV097_MAX_DRAW_INDEX)) {
+        g_array_append_val(ctx->draw_index, index);
+    }
+}
+
+static void nv097_array_element16(NVGFState *s, NVGRContext *ctx,
+                                  uint32_t *regs, uint32_t method,
+                                  uint32_t param)
+{
+    nv097_push_index(ctx, param & 0xffff);
+    nv097_push_index(ctx, param >> 16);
+}
+
+static void nv097_array_element32(NVGFState *s, NVGRContext *ctx,
+                                  uint32_t *regs, uint32_t method,
+                                  uint32_t param)
+{
+    nv097_push_index(ctx, param);
+}
+
+static void nv097_draw_arrays(NVGFState *s, NVGRContext *ctx,
+                              uint32_t *regs, uint32_t method,
+                              uint32_t param)
+{
+    uint32_t start = param & NV097_DRAW_ARRAYS_START_MASK;
+    uint32_t count = (param >> NV097_DRAW_ARRAYS_COUNT_SHIFT) + 1;
+    uint32_t i;
+    
+    for (i = 0; i < count; i++) {
+        nv097_push_index(ctx, start + i);
+    }
+}
+
+static void nv097_inline_array_bulk(NVGFState *s, NVGRContext *ctx,
+                                    uint32_t *regs, uint32_t method,
+                                    const void *data, unsigned count)
+{
+    if (!ctx->inline_array) {
+        ctx->inline_array = g_byte_array_new();
+    }
+    if (nv097_draw_fits(ctx, ctx->inline_array->len, count * 4,
+                        NV097_MAX_INLINE_ARRAY)) {
+        g_byte_array_append(ctx->inline_array, data, count * 4);
+    }
+}
+
+static void nv097_inline_array(NVGFState *s, NVGRContext *ctx,
+                               uint32_t *regs, uint32_t method,
+                               uint32_t param)
+{
+    uint32_t le = cpu_to_le32(param);
+    
+    nv097_inline_array_bulk(s, ctx, regs, method, &le, 1);
+}
+
+/* Engine pixel format of a 2D surface, false for unknown formats */
+static bool nv_surf2d_format(uint32_t format, unsigned *texel)
+{
+    switch (format) {
+    case NV042_COLOR_FORMAT_Y8:
+        *texel = NV_TEXEL_L8;
+        return true;
+    case NV042_COLOR_FORMAT_X1R5G5B5_Z1:
+    case NV042_COLOR_FORMAT_X1R5G5B5_O1:
+        *texel = NV_TEXEL_X1R5G5B5;
+        return true;
+    case NV042_COLOR_FORMAT_R5G6B5:
+        *texel = NV_TEXEL_R5G6B5;
+        return true;
+    case NV042_COLOR_FORMAT_Y16:
+        *texel = NV_TEXEL_R16;
+        return true;
+    case NV042_COLOR_FORMAT_X8R8G8B8_Z8:
+    case NV042_COLOR_FORMAT_X8R8G8B8_O8:
+        *texel = NV_TEXEL_X8R8G8B8;
+        return true;
+    case NV042_COLOR_FORMAT_A8R8G8B8:
+        *texel = NV_TEXEL_A8R8G8B8;
+        return true;
+    case NV042_COLOR_FORMAT_Y32:
+        *texel = NV_TEXEL_R32;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* IFC source pixels; expanding to 32 bpp always makes them opaque */
+static unsigned nv061_texel_format(uint32_t format)
+{
+    switch (format) {
+    case NV061_COLOR_FORMAT_R5G6B5:
+        return NV_TEXEL_R5G6B5;
+    case NV061_COLOR_FORMAT_A8R8G8B8:
+        return NV_TEXEL_A8R8G8B8;
+    default:
+        return format > NV061_COLOR_FORMAT_A8R8G8B8 ? NV_TEXEL_X8R8G8B8 :
+               NV_TEXEL_X1R5G5B5;
+    }
+}
+
+static void nv061_size_in(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                          uint32_t method, uint32_t param)
+{
+    regs[method / 4] = param;
+    ctx->ifc_pos = 0;
+    ctx->ifc_line = 0;
+}
+
+/*
+ * Image data for the rectangle set up by POINT and SIZE_IN, each source
+ * line padded to a word.  The destination is the 2D surface state of the
+ * channel rather than the object named by SET_CONTEXT_SURFACE.
+ */
+static void nv061_color_bulk(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                             uint32_t method, const void *data,
+                             unsigned count)
+{
+    const uint32_t *surf = ctx->surf2d;
+    uint32_t point = regs[NV061_POINT / 4];
+    uint32_t size_in = regs[NV061_SIZE_IN / 4];
+    uint32_t src_format = regs[NV061_SET_COLOR_FORMAT / 4];
+    uint32_t dst_format = surf[NV042_SET_COLOR_FORMAT / 4];
+    uint32_t pitch = surf[NV042_SET_PITCH / 4] >> 16;
+    unsigned src_texel = nv061_texel_format(src_format);
+    unsigned sbpp = nv_texel_size(src_texel);
+    unsigned dst_texel, dbpp = 0;
+    unsigned width = size_in & 0xffff;
+    unsigned height = size_in >> 16;
+    uint32_t line_bytes = ROUND_UP(width * sbpp, 4);
+    int x = (int16_t)point;
+    int y = (int16_t)(point >> 16);
+    const uint8_t *src = data;
+    size_t left = (size_t)count * 4;
+    uint32_t take, end, offset;
+    NVDMAMapping m;
+    NVDMAObject dst;
+    uint8_t *d;
+    
+    if (nv_surf2d_format(dst_format, &dst_texel)) {
+        dbpp = nv_texel_size(dst_texel);
+    }
+    if (!dbpp || !width || (sbpp != dbpp && dbpp == 1)) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: IFC from format %u to surface "
+                      "format %u\n", src_format, dst_format);
+        return;
+    }
+    
+    nv_dma_load(s, surf[NV042_SET_CONTEXT_DMA_IMAGE_DESTIN / 4], &dst);
+    while (left && ctx->ifc_line < height) {
+        take = MIN(left, line_bytes - ctx->ifc_pos);
+        end = MIN(ctx->ifc_pos + take, width * sbpp);
+        
+        /* Lines partly off the surface top-left are dropped */
+        if (end > ctx->ifc_pos && x >= 0 && y + (int)ctx->ifc_line >= 0) {
+            offset = surf[NV042_SET_OFFSET_DESTIN / 4] +
+                     (y + ctx->ifc_line) * pitch +
+                     (x + ctx->ifc_pos / sbpp) * dbpp;
+            d = nv_dma_map(s, &dst, offset,
+                           (end - ctx->ifc_pos) / sbpp * dbpp, true, &m);
+            if (!d) {
+                qemu_log_mask(LOG_GUEST_ERROR, "geforce3: IFC write outside "
+                              "its surface\n");
+                nv_pgraph_raise(s, NV_PGRAPH_INTR_ERROR);
+                return;
+            }
+            nv_convert_pixels(d, dst_texel, src, src_texel,
+                              (end - ctx->ifc_pos) / sbpp);
+            nv_dma_unmap(s, &m);
+        }
+        
+        src += take;
+        left -= take;
+        ctx->ifc_pos += take;
+        if (ctx->ifc_pos == line_bytes) {
+            ctx->ifc_pos = 0;
+            ctx->ifc_line++;
+        }
+    }
+}
+
+static void nv061_color(NVGFState *s, NVGRContext *ctx, uint32_t *regs,
+                        uint32_t method, uint32_t param)
+{
+    uint32_t le = cpu_to_le32(param);
+    
+    nv061_color_bulk(s, ctx, regs, method, &le, 1);
+}
+
+#define NV_METHOD_ENTRY(mthd, n, fn) \
+    [(mthd) / 4 ... (mthd) / 4 + (n) - 1] = fn,
+
+#define NV_METHOD_TABLE(cls, state, list, bulk) \
+    static NVMethodFn * const nv_methods_##cls[NV_METHOD_TABLE_SIZE] = { \
+        list(NV_METHOD_ENTRY) \
+    }; \
+    static NVMethodBulkFn * const nv_bulk_##cls[NV_METHOD_TABLE_SIZE] = { \
+        bulk(NV_METHOD_ENTRY) \
+    };
+
+#define NV_CLASS_ENTRY(cls, state, list, bulk) \
+    { cls, #state, offsetof(NVGRContext, state), nv_methods_##cls, \
+      nv_bulk_##cls },
+
+NV_CLASSES(NV_METHOD_TABLE)
+
+static const NVClass nv_classes[] = {
+    NV_CLASSES(NV_CLASS_ENTRY)
+};
+
+static const NVClass *nv_find_class(uint32_t grclass)
+{
+    int i;
+    
+    for (i = 0; i < ARRAY_SIZE(nv_classes); i++) {
+        if (nv_classes[i].grclass == grclass) {
+            return &nv_classes[i];
+        }
+    }
+    return NULL;
+}
+
+static void nv_pgraph_method(NVGFState *s, unsigned subc, uint32_t method,
+                             uint32_t param)
+{
+    NVGRContext *ctx = s->pgraph.ctx;
+    NVGRObject *obj = &ctx->subc[subc];
+    NVMethodFn *fn = NULL;
+    
+    if (!obj->grclass) {
+        qemu_log_mask(LOG_GUEST_ERROR, "geforce3: method 0x%04x on empty "
+                      "subchannel %u\n", method, subc);
+        nv_pgraph_raise(s, NV_PGRAPH_INTR_ERROR);
+        return;
+    }
+    if (obj->cls && method < NV_METHOD_TABLE_SIZE * 4) {
+        fn = obj->cls->methods[method / 4];
+    }
+    if (!fn) {
+        qemu_log_mask(LOG_UNIMP, "geforce3: class 0x%04x method 0x%04x "
+                      "param 0x%08x\n", obj->grclass, method, param);
+        return;
+    }
+    fn(s, ctx, (uint32_t *)((uint8_t *)ctx + obj->cls->state), method, param);
+}
+
+/* Execute one method; false if the channel has to yield */
+static bool nv_pfifo_method(NVGFState *s, unsigned chid, unsigned subc,
+                            uint32_t method, uint32_t param)
+{
+    NVChannel *ch = &s->pfifo.channels[chid];
+    NVGRObject *obj = &s->pgraph.ctx->subc[subc];
+    NVDMAObject dma;
+    uint32_t context;
+    
+    if (method >= NV_MTHD_OBJECT_BASE) {
+        if (obj->engine != NV_ENGINE_GRAPHICS) {
+            qemu_log_mask(LOG_UNIMP, "geforce3: method 0x%04x for software "
+                          "object 0x%08x\n", method, obj->handle);
+            nv_pfifo_raise(s, NV_PFIFO_INTR_0_CACHE_ERROR);
+            return true;
+        }
+        nv_pgraph_method(s, subc, method, param);
+        return true;
+    }
+    
+    switch (method) {
+    case NV_MTHD_SET_OBJECT:
+        if (!nv_ramht_lookup(s, chid, param, &context)) {
+            qemu_log_mask(LOG_GUEST_ERROR, "geforce3: channel %u: no object "
+                          "0x%08x in RAMHT\n", chid, param);
+            nv_pfifo_raise(s, NV_PFIFO_INTR_0_CACHE_ERROR);
+            break;
+        }
+        obj->handle = param;
+        obj->instance = (context & NV_RAMHT_INSTANCE) << 4;
+        obj->engine = (context >> NV_RAMHT_ENGINE_SHIFT) & 3;
+        obj->grclass = nv_ramin_rd32(s, obj->instance) & 0xfff;
+        obj->cls = nv_find_class(obj->grclass);
+        break;
+    case NV_MTHD_REF_CNT:
+        qatomic_set(&ch->ref, param);
+        break;
+    case NV_MTHD_SEMAPHORE_CTXDMA:
+        if (nv_ramht_lookup(s, chid, param, &context)) {
+            ch->semaphore_instance = (context & NV_RAMHT_INSTANCE) << 4;
+        }
+        break;
+    case NV_MTHD_SEMAPHORE_OFFSET:
+        ch->semaphore_offset = param;
+        break;
+    case NV_MTHD_SEMAPHORE_ACQUIRE:
+        ch->acquire_value = param;
+        if (!nv_semaphore_ready(s, ch)) {
+            ch->acquire_pending = true;
+            return false;
+        }
+        break;
+    case NV_MTHD_SEMAPHORE_RELEASE:
+        nv_dma_load(s, ch->semaphore_instance, &dma);
+        nv_dma_wr32(s, &dma, ch->semaphore_offset, param);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP, "geforce3: channel %u: method 0x%04x\n",
+                      chid, method);
+        break;
+    }
+    return true;
+}
+
+/*
+ * Hand up to @count fetched data words to the bulk handler of the current
+ * method in one call.  Returns the number of words consumed, or 0 if the
+ * run has to go word by word.
+ */
+static unsigned nv_pfifo_bulk(NVGFState *s, NVChannel *ch, const void *data,
+                              unsigned count)
+{
+    NVGRContext *ctx = s->pgraph.ctx;
+    NVGRObject *obj = &ctx->subc[ch->subchannel];
+    uint32_t method = ch->method;
+    NVMethodBulkFn *fn;
+    unsigned n;
+    
+    if (method < NV_MTHD_OBJECT_BASE || obj->engine != NV_ENGINE_GRAPHICS ||
+        !obj->cls) {
+        return 0;
+    }
+    fn = obj->cls->bulk[method / 4];
+    if (!fn) {
+        return 0;
+    }
+    if (!ch->non_increasing) {
+        /* An increasing run must not leave the stream's methods */
+        for (n = 1; n < count && method / 4 + n < NV_METHOD_TABLE_SIZE &&
+                    obj->cls->bulk[method / 4 + n] == fn; n++) {
+            /* nothing */
+        }
+        count = n;
+    }
+    
+    fn(s, ctx, (uint32_t *)((uint8_t *)ctx + obj->cls->state), method, data,
+       count);
+    return count;
+}
+
+/* Window of the pushbuffer the pusher decodes from */
+typedef struct NVPushWindow {
+    NVDMAMapping map;
+    const uint8_t *ptr;
+    uint32_t base;
+    uint32_t len;
+} NVPushWindow;
+
+/*
+ * Make the pushbuffer from @get on available as one window: mapped when
+ * possible, else copied in one transfer.  Jumps, calls and returns that
+ * land inside a mapped window keep using it, see nv_pfifo_jump().
+ */
+static bool nv_pfifo_fetch(NVGFState *s, NVPushWindow *w,
+                           const NVDMAObject *pb, uint32_t get, uint32_t put)
+{
+    uint64_t end = put > get ? put : (uint64_t)pb->limit + 1;
+    uint32_t len = MIN(end - get, NV_PFIFO_FETCH_SIZE) & ~3;
+    
+    nv_dma_unmap(s, &w->map);
+    w->len = 0;
+    
+    while (len) {
+        w->ptr = nv_dma_map(s, pb, get, len, false, &w->map);
+        if (!w->ptr && nv_dma_read(s, pb, get, s->pfifo.fetch_buf, len)) {
+            w->ptr = s->pfifo.fetch_buf;
+        }
+        if (w->ptr) {
+            w->base = get;
+            w->len = len;
+            return true;
+        }
+        /* Retry with just the next word before calling it a fault */
+        len = len > 4 ? 4 : 0;
+    }
+    return false;
+}
+
+/*
+ * The pusher moved backwards or elsewhere.  A mapped window still shows
+ * the guest's memory, but a copy may be stale by now if the guest has
+ * rewritten the commands behind GET, so it is fetched again.
+ */
+static inline void nv_pfifo_jump(NVGFState *s, NVPushWindow *w)
+{
+    if (w->ptr == s->pfifo.fetch_buf) {
+        w->len = 0;
+    }
+}
+
+static void nv_pfifo_pusher_error(NVGFState *s, NVChannel *ch, uint32_t error)
+{
+    ch->error = error;
+    nv_pfifo_raise(s, NV_PFIFO_INTR_0_DMA_PUSHER);
+}
+
+/* Run channel @chid for at most one timeslice, without the PFIFO lock */
+static void nv_pfifo_run_channel(NVGFState *s, unsigned chid)
+{
+    NVChannel *ch = &s->pfifo.channels[chid];
+    int64_t deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                       (int64_t)s->pfifo.timeslice_us * SCALE_US;
+    uint32_t get = ch->dma_get;
+    NVPushWindow w = { };
+    uint32_t put, word, avail;
+    const uint8_t *data;
+    unsigned n = 0, bulk;
+    NVDMAObject pb;
+    
+    /*
+     * Only scheduled once a pending acquire is satisfied.  The releaser
+     * may be the CPU, whose writes to textures are only seen by a harvest.
+     */
+    s->pgraph.dirty_sync |= ch->acquire_pending;
+    ch->acquire_pending = false;
+    
+    nv_dma_load(s, ch->dma_instance << 4, &pb);
+    while (get != (put = qatomic_read(&ch->dma_put))) {
+        if (get - w.base >= w.len &&
+            !nv_pfifo_fetch(s, &w, &pb, get, put)) {
+            nv_pfifo_pusher_error(s, ch, NV_DMA_ERROR_PROTECTION);
+            break;
+        }
+        data = w.ptr + (get - w.base);
+        avail = w.len - (get - w.base);
+        if (put > get) {
+            avail = MIN(avail, put - get);
+        }
+        
+        /* Data streams go to their class in one piece */
+        if (ch->method_count > 1 && avail >= 8) {
+            bulk = nv_pfifo_bulk(s, ch, data,
+                                 MIN(ch->method_count, avail / 4));
+            if (bulk) {
+                get += bulk * 4;
+                if (!ch->non_increasing) {
+                    ch->method += bulk * 4;
+                }
+                ch->method_count -= bulk;
+                qatomic_set(&ch->dma_get, get);
+                if (qatomic_read(&s->pfifo.preempt) ||
+                    qemu_clock_get_ns(QEMU_CLOCK_REALTIME) >= deadline) {
+                    break;
+                }
+                continue;
+            }
+        }
+        
+        word = ldl_le_p(data);
+        get += 4;
+        
+        if (ch->method_count) {
+            /* Data word of the current method header */
+            bool more = nv_pfifo_method(s, chid, ch->subchannel, ch->method,
+                                        word);
+            if (!ch->non_increasing) {
+                ch->method += 4;
+            }
+            ch->method_count--;
+            if (!more) {
+                qatomic_set(&ch->dma_get, get);
+                break;
+            }
+        } else if ((word & NV_CMD_OLD_JUMP_MASK) == NV_CMD_OLD_JUMP) {
+            get = word & NV_CMD_OLD_JUMP_OFFSET;
+            nv_pfifo_jump(s, &w);
+        } else if ((word & NV_CMD_TYPE_MASK) == NV_CMD_JUMP) {
+            get = word & ~NV_CMD_TYPE_MASK;
+            nv_pfifo_jump(s, &w);
+        } else if ((word & NV_CMD_TYPE_MASK) == NV_CMD_CALL) {
+            if (ch->subroutine & 1) {
+                nv_pfifo_pusher_error(s, ch, NV_DMA_ERROR_CALL_ACTIVE);
+                break;
+            }
+            ch->subroutine = get | 1;
+            get = word & ~NV_CMD_TYPE_MASK;
+            nv_pfifo_jump(s, &w);
+        } else if (word == NV_CMD_RETURN) {
+            if (!(ch->subroutine & 1)) {
+                nv_pfifo_pusher_error(s, ch, NV_DMA_ERROR_RETURN_INACTIVE);
+                break;
+            }
+            get = ch->subroutine & ~3;
+            ch->subroutine = 0;
+            nv_pfifo_jump(s, &w);
+        } else if ((word & NV_CMD_METHOD_MASK) == NV_CMD_INCREASING ||
+                   (word & NV_CMD_METHOD_MASK) == NV_CMD_NON_INCREASING) {
+            ch->method = word & 0x1ffc;
+            ch->subchannel = (word >> 13) & 7;
+            ch->method_count = (word >> 18) & 0x7ff;
+            ch->non_increasing = word & NV_CMD_NON_INCREASING;
+        } else {
+            nv_pfifo_pusher_error(s, ch, NV_DMA_ERROR_INVALID_CMD);
+            break;
+        }
+        qatomic_set(&ch->dma_get, get);
+        
+        /* Only look at the clock every so often */
+        if (!(++n & 63) &&
+            (qatomic_read(&s->pfifo.preempt) ||
+             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) >= deadline)) {
+            break;
+        }
+    }
+    nv_dma_unmap(s, &w.map);
+}
+
+/*
+ * Nothing to run: wait for a doorbell, with the PFIFO lock held.  A guest
+ * that is submitting back to back rings again within microseconds, so
+ * spin for a moment before paying for a sleep and a wake up.  An idle
+ * guest rang long ago and the thread sleeps right away.
+ */
+static void nv_pfifo_wait(NVGFState *s, bool blocked)
+{
+    NVPFIFOState *f = &s->pfifo;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t end = now + (int64_t)f->spin_us * SCALE_US;
+    uint32_t kicks = f->kicks;
+    
+    if (f->spin_us && now - f->last_kick < NV_PFIFO_SPIN_WINDOW_NS) {
+        qemu_mutex_unlock(&f->lock);
+        while (qatomic_read(&f->kicks) == kicks && !qatomic_read(&f->stop) &&
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end) {
+            cpu_relax();
+        }
+        qemu_mutex_lock(&f->lock);
+        if (f->kicks != kicks || f->stop) {
+            return;
+        }
+    }
+    
+    if (!blocked) {
+        qemu_cond_wait(&f->cond, &f->lock);
+        return;
+    }
+    
+    /*
+     * Releases by other channels are seen as soon as they run, but the
+     * CPU can release a semaphore with a plain store to memory.  Poll for
+     * that, less often the longer nothing happens.
+     */
+    if (!qemu_cond_timedwait(&f->cond, &f->lock, f->poll_ms)) {
+        f->poll_ms = MIN(f->poll_ms * 2, NV_PFIFO_POLL_MAX_MS);
+    }
+}
+
+static void *nv_pfifo_thread(void *opaque)
+{
+    NVGFState *s = opaque;
+    NVPFIFOState *f = &s->pfifo;
+    bool blocked;
+    int chid;
+    
+    qemu_mutex_lock(&f->lock);
+    while (!f->stop) {
+        if (f->paused) {
+            qemu_cond_wait(&f->cond, &f->lock);
+            continue;
+        }
+        chid = nv_pfifo_next_channel(s, &blocked);
+        if (chid < 0) {
+            nv_pfifo_wait(s, blocked);
+            continue;
+        }
+        
+        f->poll_ms = 1;
+        nv_pfifo_switch_channel(s, chid);
+        f->busy_chid = chid;
+        qemu_mutex_unlock(&f->lock);
+        
+        nv_pfifo_run_channel(s, chid);
+        
+        qemu_mutex_lock(&f->lock);
+        f->busy_chid = -1;
+        qemu_cond_broadcast(&f->idle);
+    }
+    qemu_mutex_unlock(&f->lock);
+    return NULL;
+}
+
+static void nv_pfifo_start(NVGFState *s)
+{
+    NVPFIFOState *f = &s->pfifo;
+    
+    if (f->running) {
+        return;
+    }
+    f->stop = false;
+    f->running = true;
+    f->poll_ms = 1;
+    qemu_thread_create(&f->thread, "geforce3-fifo", nv_pfifo_thread, s,
+                       QEMU_THREAD_JOINABLE);
+}
+
+static void nv_pfifo_stop(NVGFState *s)
+{
+    NVPFIFOState *f = &s->pfifo;
+    
+    if (!f->running) {
+        return;
+    }
+    WITH_QEMU_LOCK_GUARD(&f->lock) {
+        qatomic_set(&f->stop, true);
+        qemu_cond_signal(&f->cond);
+        qemu_cond_broadcast(&s->pgraph.dirty_cond);
+    }
+    qemu_thread_join(&f->thread);
+    f->running = false;
+}
+
+/*
+ * Nothing may touch guest memory while the VM is stopped, e.g. for the
+ * last pass of a migration.  Render batches are waited for by the method
+ * that submitted them, so an idle PFIFO thread leaves none in flight.
+ */
+static void nv_vm_state_change(void *opaque, bool running, RunState state)
+{
+    NVGFState *s = opaque;
+    NVPFIFOState *f = &s->pfifo;
+    
+    WITH_QEMU_LOCK_GUARD(&f->lock) {
+        f->paused = !running;
+        if (running) {
+            qemu_cond_signal(&f->cond);
+        } else {
+            nv_pfifo_wait_idle(s, UINT32_MAX);
+        }
+    }
+}
+
+/*
+ * Drop all graphics contexts and PGRAPH state; the PFIFO thread must be
+ * stopped.  Channels allocate a fresh context when they next run.
+ */
+static void nv_pgraph_reset(NVGFState *s)
+{
+    int i;
+    
+    for (i = 0; i < NV_NUM_CHANNELS; i++) {
+        nv_grctx_free(s->pfifo.channels[i].grctx);
+        s->pfifo.channels[i].grctx = NULL;
+    }
+    memset(s->pgraph.regs, 0, sizeof(s->pgraph.regs));
+    s->pgraph.intr = 0;
+    s->pgraph.intr_en = 0;
+    s->pgraph.ctx = NULL;
+    nv_pgraph_release_textures(s);
+    memset(s->pgraph.surface_tag, 0, sizeof(s->pgraph.surface_tag));
+}
+
+/* Drop all channels and contexts; the PFIFO thread must be stopped */
+static void nv_pfifo_reset(NVGFState *s)
+{
+    nv_pgraph_reset(s);
+    memset(s->pfifo.channels, 0, sizeof(s->pfifo.channels));
+    memset(s->pfifo.regs, 0, sizeof(s->pfifo.regs));
+    s->pfifo.intr = 0;
+    s->pfifo.intr_en = 0;
+    s->pfifo.cur_chid = -1;
+    s->pfifo.busy_chid = -1;
+}
+
+/*
+ * Channels and graphics contexts aren't part of the migration stream, so
+ * migration is blocked while any channel is in DMA mode.  Called with the
+ * BQL held.
+ */
+static void nv_pfifo_update_blocker(NVGFState *s)
+{
+    bool dma = s->pfifo.regs[(NV_PFIFO_MODE - NV_PFIFO_BASE) / 4];
+    Error *err = NULL;
+    
+    if (!dma) {
+        migrate_del_blocker(&s->migration_blocker);
+    } else if (!s->migration_blocker) {
+        error_setg(&s->migration_blocker,
+                   "geforce3: channel state is not migrated");
+        if (migrate_add_blocker(&s->migration_blocker, &err) < 0) {
+            error_report_err(err);
+        }
+    }
+}
 
-/* NV20 (GeForce3) architecture constants */
-#define NV_ARCH_20              0x20
-#define NV_IMPL_GEFORCE3        0x00
-#define NV_IMPL_GEFORCE3_TI200  0x01
-#define NV_IMPL_GEFORCE3_TI500  0x02
+/*
+ * Host resources of PGRAPH: the render pool client, which keeps the pool
+ * threads alive, and the decode caches.  They only exist while PGRAPH is
+ * enabled, so a guest on the VGA console or a plain framebuffer never
+ * pays for them.
+ */
+static void nv_pgraph_power(NVGFState *s, bool on)
+{
+    if (on == !!s->render) {
+        return;
+    }
+    if (on) {
+        s->cache = s->shared_cache ? nv_cache_table_shared() :
+                   nv_cache_table_new();
+        s->render = nv_render_client_new(s->render_weight);
+        return;
+    }
+    
+    nv_pgraph_release_textures(s);
+    nv_cache_table_unref(s->cache);
+    s->cache = NULL;
+    nv_render_client_free(s->render);
+    s->render = NULL;
+}
 
-typedef struct NVGFState {
-    PCIDevice parent_obj;
+/*
+ * Bring the engines in line with PMC_ENABLE; the PFIFO thread must be
+ * stopped.  Methods run on the PFIFO thread, so it only runs while both
+ * PFIFO and PGRAPH are enabled; pushbuffers just queue up meanwhile.
+ */
+static void nv_pmc_apply(NVGFState *s)
+{
+    nv_pgraph_power(s, s->pmc_enable & NV_PMC_ENABLE_PGRAPH);
+    if ((s->pmc_enable & NV_PMC_ENABLE_ENGINES) == NV_PMC_ENABLE_ENGINES) {
+        nv_pfifo_start(s);
+    }
+}
+
+static void nv_pmc_write_enable(NVGFState *s, uint32_t val)
+{
+    uint32_t off = s->pmc_enable & ~val;
     
-    /* VGA compatibility */
-    VGACommonState vga;
+    if (!((s->pmc_enable ^ val) & NV_PMC_ENABLE_ENGINES)) {
+        s->pmc_enable = val;
+        return;
+    }
     
-    /* Memory regions */
-    MemoryRegion mmio;
-    MemoryRegion lfb;
-    MemoryRegion crtc;
+    nv_pfifo_stop(s);
+    s->pmc_enable = val;
     
-    /* DDC/I2C support */
-    I2CBus *i2c_bus;
-    I2CSlave *i2c_ddc;
-    uint8_t ddc_state;
+    /* Disabling an engine resets it */
+    if (off & NV_PMC_ENABLE_PFIFO) {
+        nv_pfifo_reset(s);
+    } else if (off & NV_PMC_ENABLE_PGRAPH) {
+        nv_pgraph_reset(s);
+    }
+    nv_update_irq(s);
+    nv_pmc_apply(s);
+}
+
+static uint64_t nv_pfifo_read(NVGFState *s, hwaddr addr)
+{
+    NVPFIFOState *f = &s->pfifo;
+    NVChannel *ch;
     
-    /* EDID support */
-    qemu_edid_info edid_info;
-    uint8_t edid_blob[256];
-    bool edid_enabled;
+    QEMU_LOCK_GUARD(&f->lock);
     
-    /* Device registers */
-    uint32_t prmvio[NV_PRMVIO_SIZE / 4];
+    ch = f->cur_chid < 0 ? NULL : &f->channels[f->cur_chid];
+    switch (addr) {
+    case NV_PFIFO_INTR_0:
+        return qatomic_read(&f->intr);
+    case NV_PFIFO_INTR_EN_0:
+        return f->intr_en;
+    case NV_PFIFO_RUNOUT_STATUS:
+        return NV_PFIFO_RUNOUT_STATUS_LOW_MARK;
+    case NV_PFIFO_CACHE1_STATUS:
+        return (!ch || qatomic_read(&ch->dma_get) == ch->dma_put) ?
+               NV_PFIFO_CACHE1_STATUS_EMPTY : 0;
+    case NV_PFIFO_CACHE1_DMA_PUT:
+        return ch ? ch->dma_put : 0;
+    case NV_PFIFO_CACHE1_DMA_GET:
+        return ch ? qatomic_read(&ch->dma_get) : 0;
+    case NV_PFIFO_CACHE1_REF:
+        return ch ? qatomic_read(&ch->ref) : 0;
+    case NV_PFIFO_CACHE1_DMA_INSTANCE:
+        return ch ? ch->dma_instance : 0;
+    case NV_PFIFO_CACHE1_DMA_STATE:
+        return ch ? nv_channel_dma_state(ch) : 0;
+    case NV_PFIFO_CACHE1_DMA_SUBROUTINE:
+        return ch ? ch->subroutine : 0;
+    default:
+        return f->regs[(addr - NV_PFIFO_BASE) / 4];
+    }
+}
+
+static void nv_pfifo_write(NVGFState *s, hwaddr addr, uint32_t val)
+{
+    NVPFIFOState *f = &s->pfifo;
+    uint32_t *reg = &f->regs[(addr - NV_PFIFO_BASE) / 4];
+    uint32_t changed;
+    int chid;
     
-    /* VBE support */
-    uint16_t vbe_index;
-    uint16_t vbe_regs[16]; /* VBE register array */
+    WITH_QEMU_LOCK_GUARD(&f->lock) {
+        switch (addr) {
+        case NV_PFIFO_INTR_0:
+            qatomic_and(&f->intr, ~val);
+            break;
+        case NV_PFIFO_INTR_EN_0:
+            f->intr_en = val;
+            break;
+        case NV_PFIFO_MODE:
+            changed = *reg ^ val;
+            nv_pfifo_wait_idle(s, changed);
+            *reg = val;
+            for (chid = 0; chid < NV_NUM_CHANNELS; chid++) {
+                if (!(changed & BIT(chid))) {
+                    continue;
+                }
+                if (val & BIT(chid)) {
+                    nv_pfifo_enable_channel(s, chid);
+                } else {
+                    nv_pfifo_unload_channel(s, chid);
+                }
+            }
+            break;
+        case NV_PFIFO_CACHE1_DMA_PUT:
+        case NV_PFIFO_CACHE1_DMA_GET:
+            /* Only meaningful while the pusher is idle */
+            if (f->cur_chid >= 0 && f->busy_chid < 0) {
+                NVChannel *ch = &f->channels[f->cur_chid];
+                
+                if (addr == NV_PFIFO_CACHE1_DMA_PUT) {
+                    qatomic_inc(&f->kicks);
+                    ch->dma_put = val;
+                } else {
+                    ch->dma_get = val;
+                }
+            }
+            break;
+        default:
+            *reg = val;
+            break;
+        }
+        qemu_cond_signal(&f->cond);
+    }
+    if (addr == NV_PFIFO_MODE) {
+        nv_pfifo_update_blocker(s);
+    }
+    nv_update_irq(s);
+}
+
+/*
+ * USER registers of @chid.  Channels in DMA mode are loaded from RAMFC if
+ * needed, e.g. after migration; other channels only keep what the guest
+ * writes here until they are enabled.  Called with the PFIFO lock held.
+ */
+static NVChannel *nv_user_channel(NVGFState *s, unsigned chid)
+{
+    if (s->pfifo.regs[(NV_PFIFO_MODE - NV_PFIFO_BASE) / 4] & BIT(chid)) {
+        return nv_pfifo_load_channel(s, chid);
+    }
+    return &s->pfifo.channels[chid];
+}
+
+static uint64_t nv_user_read(NVGFState *s, hwaddr addr)
+{
+    unsigned chid = addr / NV_USER_CHANNEL_SIZE;
+    NVChannel *ch;
     
-    /* NVIDIA-specific registers */
-    uint32_t pmc_boot_0;
-    uint32_t pmc_intr_0;
-    uint32_t pmc_intr_en_0;
-    uint32_t architecture;
-    uint32_t implementation;
+    QEMU_LOCK_GUARD(&s->pfifo.lock);
     
-} NVGFState;
+    ch = nv_user_channel(s, chid);
+    switch (addr & (NV_USER_CHANNEL_SIZE - 1)) {
+    case NV_USER_DMA_PUT:
+        return ch->dma_put;
+    case NV_USER_DMA_GET:
+        return qatomic_read(&ch->dma_get);
+    case NV_USER_REF:
+        return qatomic_read(&ch->ref);
+    default:
+        return 0;
+    }
+}
 
-/* Forward declarations */
-static void geforce_ddc_init(NVGFState *s);
-static uint64_t geforce_ddc_read(void *opaque, hwaddr addr, unsigned size);
-static void geforce_ddc_write(void *opaque, hwaddr addr, uint64_t val, unsigned size);
-static void geforce_ui_info(void *opaque, uint32_t idx, QemuUIInfo *info);
-static uint32_t nv_compute_boot0(NVGFState *s);
-static void nv_apply_model_ids(NVGFState *s);
-static uint64_t nv_bar0_readl(void *opaque, hwaddr addr, unsigned size);
+static void nv_user_write(NVGFState *s, hwaddr addr, uint32_t val)
+{
+    unsigned chid = addr / NV_USER_CHANNEL_SIZE;
+    NVChannel *ch;
+    
+    QEMU_LOCK_GUARD(&s->pfifo.lock);
+    
+    ch = nv_user_channel(s, chid);
+    switch (addr & (NV_USER_CHANNEL_SIZE - 1)) {
+    case NV_USER_DMA_PUT:
+        /* Counted first: methods seen by the pusher imply their kick */
+        qatomic_inc(&s->pfifo.kicks);
+        smp_wmb();
+        qatomic_set(&ch->dma_put, val);
+        ch->put_written = !ch->loaded;
+        ch->error = 0;
+        s->pfifo.last_kick = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        qemu_cond_signal(&s->pfifo.cond);
+        break;
+    case NV_USER_DMA_GET:
+        if (chid != s->pfifo.busy_chid) {
+            ch->dma_get = val;
+            ch->error = 0;
+        }
+        break;
+    default:
+        break;
+    }
+}
 
-/* VGA I/O operations */
-static uint64_t geforce_vga_ioport_read(void *opaque, hwaddr addr, unsigned size)
+static uint64_t nv_pgraph_read(NVGFState *s, hwaddr addr)
 {
-    NVGFState *s = opaque;
-    return vga_ioport_read(&s->vga, addr);
+    switch (addr) {
+    case NV_PGRAPH_INTR:
+        return qatomic_read(&s->pgraph.intr);
+    case NV_PGRAPH_INTR_EN:
+        return s->pgraph.intr_en;
+    default:
+        return s->pgraph.regs[(addr - NV_PGRAPH_BASE) / 4];
+    }
 }
 
-static void geforce_vga_ioport_write(void *opaque, hwaddr addr, uint64_t val, unsigned size)
+static void nv_pgraph_write(NVGFState *s, hwaddr addr, uint32_t val)
 {
-    NVGFState *s = opaque;
-    vga_ioport_write(&s->vga, addr, val);
+    switch (addr) {
+    case NV_PGRAPH_INTR:
+        qatomic_and(&s->pgraph.intr, ~val);
+        break;
+    case NV_PGRAPH_INTR_EN:
+        s->pgraph.intr_en = val;
+        break;
+    default:
+        s->pgraph.regs[(addr - NV_PGRAPH_BASE) / 4] = val;
+        break;
+    }
+    nv_update_irq(s);
 }
 
-static const MemoryRegionOps geforce_vga_ops = {
-    .read = geforce_vga_ioport_read,
-    .write = geforce_vga_ioport_write,
-    .valid = {
-        .min_access_size = 1,
-        .max_access_size = 4,
-    },
-    .endianness = DEVICE_LITTLE_ENDIAN,
-};
+/*
+ * Drivers size VRAM from PFB instead of probing it: CSTATUS is the size
+ * in bytes, CFG0 a 128-bit bus of four DDR partitions.
+ */
+static void nv_pfb_reset(NVGFState *s)
+{
+    memset(s->pfb, 0, sizeof(s->pfb));
+    s->pfb[(NV_PFB_CFG0 - NV_PFB_BASE) / 4] = NV_PFB_CFG0_PARTS_4;
+    s->pfb[(NV_PFB_CSTATUS - NV_PFB_BASE) / 4] = s->vga.vram_size;
+}
 
-/* Compute PMC_BOOT_0 register value for nouveau driver compatibility */
-static uint32_t nv_compute_boot0(NVGFState *s)
+static uint64_t nv_pfb_read(NVGFState *s, hwaddr addr)
 {
-    /* PMC_BOOT_0 format for nouveau driver:
-     * Bits 31-20: Architecture (0x20 for NV20/GeForce3)
-     * Bits 19-16: Implementation (0x00 for standard GeForce3)
-     * Bits 15-0:  Device/revision identification
-     * 
-     * For GeForce3 (NV20), nouveau expects: 0x20200XXX
-     * Where XXX contains device-specific revision information
-     */
-    uint32_t boot0 = (s->architecture << 20) | (s->architecture << 16) | (s->implementation << 4) | 0x00;
-    return boot0;
+    return s->pfb[(addr - NV_PFB_BASE) / 4];
 }
 
-/* Apply device ID mappings for nouveau compatibility */
-static void nv_apply_model_ids(NVGFState *s)
+static void nv_pfb_write(NVGFState *s, hwaddr addr, uint32_t val)
 {
-    /* Set GeForce3 NV20 architecture */
-    s->architecture = NV_ARCH_20;
-    s->implementation = NV_IMPL_GEFORCE3;
-    
-    /* Compute PMC_BOOT_0 register */
-    s->pmc_boot_0 = nv_compute_boot0(s);
-    
-    /* Initialize other PMC registers */
-    s->pmc_intr_0 = 0x00000000;    /* No interrupts pending */
-    s->pmc_intr_en_0 = 0x00000000; /* Interrupts disabled initially */
+    /* The size is strapped, the memory configuration is up to the driver */
+    if (addr != NV_PFB_CSTATUS) {
+        s->pfb[(addr - NV_PFB_BASE) / 4] = val;
+    }
 }
 
 /* BAR0 register read handler for nouveau compatibility */
@@ -156,22 +3655,43 @@ static uint64_t nv_bar0_readl(void *opaque, hwaddr addr, unsigned size)
 {
     NVGFState *s = opaque;
     
+    if (addr >= NV_PBUS_PCI_BASE &&
+        addr + size <= NV_PBUS_PCI_BASE + NV_PBUS_PCI_SIZE) {
+        return ldn_le_p(s->parent_obj.config + addr - NV_PBUS_PCI_BASE, size);
+    }
+    if (addr >= NV_PFIFO_BASE && addr < NV_PFIFO_BASE + NV_PFIFO_SIZE) {
+        return nv_pfifo_read(s, addr);
+    }
+    if (addr >= NV_PFB_BASE && addr < NV_PFB_BASE + NV_PFB_SIZE) {
+        return nv_pfb_read(s, addr);
+    }
+    if (addr >= NV_PGRAPH_BASE && addr < NV_PGRAPH_BASE + NV_PGRAPH_SIZE) {
+        return nv_pgraph_read(s, addr);
+    }
+    if (addr >= NV_USER_BASE &&
+        addr < NV_USER_BASE + NV_NUM_CHANNELS * NV_USER_CHANNEL_SIZE) {
+        return nv_user_read(s, addr - NV_USER_BASE);
+    }
+    
     switch (addr) {
     case NV_PMC_BOOT_0:
         /* Critical register for nouveau chipset detection */
         return s->pmc_boot_0;
         
     case NV_PMC_INTR_0:
-        /* Interrupt status register */
-        return s->pmc_intr_0;
+        /* Interrupt status register, including engine interrupts */
+        return nv_pmc_intr(s);
         
     case NV_PMC_INTR_EN_0:
         /* Interrupt enable register */
         return s->pmc_intr_en_0;
         
-    case NV_PBUS_PCI_NV_1:
-        /* PCI configuration mirror */
-        return (NVIDIA_VENDOR_ID << 16) | GEFORCE3_DEVICE_ID;
+    case NV_PMC_ENABLE:
+        return s->pmc_enable;
+        
+    case NV_PBUS_DEBUG_1:
+        /* Memory type strap */
+        return NV_PBUS_DEBUG_1_DDR;
         
     default:
         /* For unhandled registers, check if it's in PRMVIO range */
@@ -196,15 +3716,47 @@ static void geforce_prmvio_write(void *opaque, hwaddr addr, uint64_t val, unsign
 {
     NVGFState *s = opaque;
     
+    if (addr >= NV_PBUS_PCI_BASE &&
+        addr + size <= NV_PBUS_PCI_BASE + NV_PBUS_PCI_SIZE) {
+        /* Through the config write path, for the masks and BAR updates */
+        pci_default_write_config(&s->parent_obj, addr - NV_PBUS_PCI_BASE,
+                                 val, size);
+        return;
+    }
+    if (addr >= NV_PFIFO_BASE && addr < NV_PFIFO_BASE + NV_PFIFO_SIZE) {
+        nv_pfifo_write(s, addr, val);
+        return;
+    }
+    if (addr >= NV_PFB_BASE && addr < NV_PFB_BASE + NV_PFB_SIZE) {
+        nv_pfb_write(s, addr, val);
+        return;
+    }
+    if (addr >= NV_PGRAPH_BASE && addr < NV_PGRAPH_BASE + NV_PGRAPH_SIZE) {
+        nv_pgraph_write(s, addr, val);
+        return;
+    }
+    if (addr >= NV_USER_BASE &&
+        addr < NV_USER_BASE + NV_NUM_CHANNELS * NV_USER_CHANNEL_SIZE) {
+        nv_user_write(s, addr - NV_USER_BASE, val);
+        return;
+    }
+    
     switch (addr) {
     case NV_PMC_INTR_0:
         /* Interrupt status register - write to clear */
         s->pmc_intr_0 &= ~val;
+        nv_update_irq(s);
         break;
         
     case NV_PMC_INTR_EN_0:
         /* Interrupt enable register */
         s->pmc_intr_en_0 = val;
+        nv_update_irq(s);
+        break;
+        
+    case NV_PMC_ENABLE:
+        /* Engine enables, gating processing and host resources */
+        nv_pmc_write_enable(s, val);
         break;
         
     default:
@@ -379,6 +3931,126 @@ static void geforce_ui_info(void *opaque, uint32_t idx, QemuUIInfo *info)
 }
 
 /* Device initialization */
+/*
+ * Back VRAM with vram-file.  Shared, the file is the VRAM itself: a
+ * template VM leaves its initialized display there and its device state
+ * is saved without VRAM.  Private, the file is mapped copy on write, so
+ * clones started from that state share every page they don't write.
+ */
+static bool nv_vram_map_file(NVGFState *s, Error **errp)
+{
+    VGACommonState *vga = &s->vga;
+    struct stat st;
+    void *ptr;
+    int fd;
+    
+    if (!s->vram_file) {
+        return true;
+    }
+    if (s->vram_file_share) {
+        fd = qemu_create(s->vram_file, O_RDWR, 0600, errp);
+    } else {
+        fd = qemu_open(s->vram_file, O_RDONLY, errp);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    
+    /*
+     * Clones map the file copy on write, so pages a running template
+     * writes would show through: the template holds the file exclusively
+     * and clones share it, the lock stays until the device goes away
+     */
+    if (qemu_lock_fd(fd, 0, 0, s->vram_file_share) < 0) {
+        error_setg(errp, "geforce3: %s is in use by %s", s->vram_file,
+                   s->vram_file_share ? "another VM" : "a running template");
+        goto fail;
+    }
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "geforce3: cannot stat %s",
+                         s->vram_file);
+        goto fail;
+    }
+    if (st.st_size < vga->vram_size) {
+        if (!s->vram_file_share) {
+            error_setg(errp, "geforce3: %s is smaller than VRAM",
+                       s->vram_file);
+            goto fail;
+        }
+        if (ftruncate(fd, vga->vram_size) < 0) {
+            error_setg_errno(errp, errno, "geforce3: cannot resize %s",
+                             s->vram_file);
+            goto fail;
+        }
+    }
+    
+    /* Replace the fresh anonymous pages, the RAM block keeps its address */
+    ptr = mmap(vga->vram_ptr, vga->vram_size, PROT_READ | PROT_WRITE,
+               MAP_FIXED | (s->vram_file_share ? MAP_SHARED : MAP_PRIVATE),
+               fd, 0);
+    if (ptr == MAP_FAILED) {
+        error_setg_errno(errp, errno, "geforce3: cannot map %s",
+                         s->vram_file);
+        goto fail;
+    }
+    s->vram_fd = fd;
+    
+    /* Clones keep migrating their private copy, a template has the file */
+    if (s->vram_file_share) {
+        vmstate_unregister_ram(&vga->vram, DEVICE(s));
+    }
+    return true;
+    
+fail:
+    close(fd);
+    return false;
+}
+
+/* Close the VRAM file, which drops its lock; the mapping goes with VRAM */
+static void nv_vram_unmap_file(NVGFState *s)
+{
+    if (s->vram_file) {
+        close(s->vram_fd);
+    }
+}
+
+/*
+ * The render threads stream through VRAM all the time: back it with
+ * transparent huge pages and prefer the host node the threads run on.
+ * Nothing has touched the fresh VRAM yet, so no pages need to move.
+ */
+static bool nv_vram_place(NVGFState *s, Error **errp)
+{
+    VGACommonState *vga = &s->vga;
+    
+    if (s->vram_hugepages &&
+        qemu_madvise(vga->vram_ptr, vga->vram_size, QEMU_MADV_HUGEPAGE)) {
+        warn_report("geforce3: cannot use huge pages for VRAM: %s",
+                    strerror(errno));
+    }
+    if (s->vram_numa_node < 0) {
+        return true;
+    }
+#ifdef CONFIG_NUMA
+    {
+        g_autofree unsigned long *nodes = bitmap_new(s->vram_numa_node + 2);
+        
+        /* mbind() drops the last bit of the mask, hence the extra one */
+        set_bit(s->vram_numa_node, nodes);
+        if (mbind(vga->vram_ptr, vga->vram_size, MPOL_PREFERRED, nodes,
+                  s->vram_numa_node + 2, 0)) {
+            error_setg_errno(errp, errno, "geforce3: cannot place VRAM on "
+                             "host node %d", s->vram_numa_node);
+            return false;
+        }
+    }
+    return true;
+#else
+    error_setg(errp, "geforce3: vram-numa-node needs NUMA support");
+    return false;
+#endif
+}
+
 static void nv_realize(PCIDevice *pci_dev, Error **errp)
 {
     NVGFState *s = GEFORCE3(pci_dev);
@@ -387,24 +4059,79 @@ static void nv_realize(PCIDevice *pci_dev, Error **errp)
     /* Initialize NVIDIA-specific registers first */
     nv_apply_model_ids(s);
     
+    if (!nv_render_pool_configure(s->render_threads, s->render_affinity,
+                                  errp)) {
+        return;
+    }
+    if (!is_power_of_2(s->vertex_cache)) {
+        error_setg(errp, "geforce3: vertex-cache must be a power of two");
+        return;
+    }
+    if (s->vram_numa_node < -1 || s->vram_numa_node >= MAX_NODES) {
+        error_setg(errp, "geforce3: vram-numa-node must be below %d",
+                   MAX_NODES);
+        return;
+    }
+    
+    /*
+     * nouveau only reads the top byte of PFB CSTATUS, so the size must be
+     * whole 16MB units; that also leaves room for RAMIN in the last MB
+     */
+    if (!vga->vram_size_mb || vga->vram_size_mb % 16) {
+        error_setg(errp, "geforce3: vgamem_mb must be a multiple of 16");
+        return;
+    }
+    
     /* FIX: Initialize VGA - Add missing Error** parameter to vga_common_init call */
     vga_common_init(vga, OBJECT(s), errp);
+    if (!nv_vram_map_file(s, errp)) {
+        return;
+    }
+    if (!nv_vram_place(s, errp)) {
+        goto fail_vram;
+    }
     vga_init(vga, OBJECT(s), pci_address_space(pci_dev), 
               pci_address_space_io(pci_dev), true);
     
+    s->ramin_ptr = vga->vram_ptr + vga->vram_size - NV_PRAMIN_SIZE;
+    nv_pfb_reset(s);
+    
     /* Set up PCI configuration */
     pci_dev->config[PCI_INTERRUPT_PIN] = 1;
     
     /* Initialize memory regions */
     memory_region_init_io(&s->mmio, OBJECT(s), &geforce_prmvio_ops, s,
-                          "geforce3-prmvio", NV_PRMVIO_SIZE);
+                          "geforce3-mmio", NV_BAR0_SIZE);
+    memory_region_init_alias(&s->ramin, OBJECT(s), "geforce3-ramin",
+                             &vga->vram, vga->vram_size - NV_PRAMIN_SIZE,
+                             NV_PRAMIN_SIZE);
+    memory_region_add_subregion(&s->mmio, NV_PRAMIN_BASE, &s->ramin);
     memory_region_init_io(&s->crtc, OBJECT(s), &geforce_crtc_ops, s,
                           "geforce3-crtc", NV_CRTC_SIZE);
     
+    /*
+     * Built-in VBIOS, unless the user gave a romfile: in the expansion
+     * ROM BAR for firmware and mirrored at PROM, where drivers read it.
+     */
+    if (!pci_dev->romfile) {
+        if (!memory_region_init_rom(&s->rom, OBJECT(s), "geforce3.rom",
+                                    NV_VBIOS_SIZE, errp)) {
+            goto fail_vram;
+        }
+        nv_vbios_build(memory_region_get_ram_ptr(&s->rom), NVIDIA_VENDOR_ID,
+                       GEFORCE3_DEVICE_ID);
+        memory_region_init_alias(&s->prom, OBJECT(s), "geforce3-prom",
+                                 &s->rom, 0, NV_VBIOS_SIZE);
+        memory_region_add_subregion(&s->mmio, NV_PROM_BASE, &s->prom);
+    }
+    
     /* Map memory regions */
     pci_register_bar(pci_dev, 0, PCI_BASE_ADDRESS_MEM_TYPE_32, &s->mmio);
     pci_register_bar(pci_dev, 1, PCI_BASE_ADDRESS_MEM_TYPE_32, &vga->vram);
     pci_register_bar(pci_dev, 2, PCI_BASE_ADDRESS_MEM_TYPE_32, &s->crtc);
+    if (!pci_dev->romfile && pci_dev->rom_bar) {
+        pci_register_bar(pci_dev, PCI_ROM_SLOT, 0, &s->rom);
+    }
     
     /* Initialize DDC and EDID */
     geforce_ddc_init(s);
@@ -417,8 +4144,118 @@ static void nv_realize(PCIDevice *pci_dev, Error **errp)
     if (vga->con) {
         dpy_set_ui_info(vga->con, geforce_ui_info, s);
     }
+    
+    /* Command processing, the engines start once PMC_ENABLE allows */
+    s->irq_bh = qemu_bh_new_guarded(nv_irq_bh, s,
+                                    &DEVICE(s)->mem_reentrancy_guard);
+    qemu_mutex_init(&s->pfifo.lock);
+    qemu_cond_init(&s->pfifo.cond);
+    qemu_cond_init(&s->pfifo.idle);
+    s->pgraph.dirty_bh = qemu_bh_new_guarded(nv_pgraph_dirty_bh, s,
+                                             &DEVICE(s)->mem_reentrancy_guard);
+    qemu_cond_init(&s->pgraph.dirty_cond);
+    s->pfifo.paused = !runstate_is_running();
+    s->vm_state = qemu_add_vm_change_state_handler(nv_vm_state_change, s);
+    nv_pfifo_reset(s);
+    nv_pmc_apply(s);
+    return;
+    
+fail_vram:
+    nv_vram_unmap_file(s);
+}
+
+static void nv_reset(DeviceState *dev)
+{
+    NVGFState *s = GEFORCE3(dev);
+    
+    nv_pfifo_stop(s);
+    nv_apply_model_ids(s);
+    nv_pfb_reset(s);
+    nv_pfifo_reset(s);
+    nv_pfifo_update_blocker(s);
+    vga_common_reset(&s->vga);
+    nv_pmc_apply(s);
+}
+
+static void nv_exit(PCIDevice *pci_dev)
+{
+    NVGFState *s = GEFORCE3(pci_dev);
+    
+    qemu_del_vm_change_state_handler(s->vm_state);
+    nv_pfifo_stop(s);
+    nv_pfifo_reset(s);
+    nv_pfifo_update_blocker(s);
+    qemu_cond_destroy(&s->pfifo.cond);
+    qemu_cond_destroy(&s->pfifo.idle);
+    qemu_mutex_destroy(&s->pfifo.lock);
+    qemu_bh_delete(s->irq_bh);
+    s->irq_bh = NULL;
+    qemu_bh_delete(s->pgraph.dirty_bh);
+    s->pgraph.dirty_bh = NULL;
+    qemu_cond_destroy(&s->pgraph.dirty_cond);
+    
+    nv_pgraph_power(s, false);
+    nv_vram_unmap_file(s);
+}
+
+static const Property nv_properties[] = {
+    DEFINE_PROP_UINT32("vgamem_mb", NVGFState, vga.vram_size_mb, 64),
+    DEFINE_PROP_UINT32("fifo-timeslice", NVGFState, pfifo.timeslice_us, 500),
+    DEFINE_PROP_UINT32("fifo-spin", NVGFState, pfifo.spin_us, 20),
+    DEFINE_PROP_BOOL("shared-cache", NVGFState, shared_cache, true),
+    DEFINE_PROP_UINT32("render-threads", NVGFState, render_threads, 0),
+    DEFINE_PROP_STRING("render-affinity", NVGFState, render_affinity),
+    DEFINE_PROP_UINT32("render-weight", NVGFState, render_weight, 100),
+    DEFINE_PROP_UINT32("vertex-cache", NVGFState, vertex_cache, 1024),
+    DEFINE_PROP_BOOL("vram-hugepages", NVGFState, vram_hugepages, false),
+    DEFINE_PROP_INT32("vram-numa-node", NVGFState, vram_numa_node, -1),
+    DEFINE_PROP_STRING("vram-file", NVGFState, vram_file),
+    DEFINE_PROP_BOOL("vram-file-share", NVGFState, vram_file_share, false),
+};
+
+static int nv_post_load(void *opaque, int version_id)
+{
+    NVGFState *s = opaque;
+    
+    nv_pfifo_stop(s);
+    nv_pfifo_update_blocker(s);
+    nv_update_irq(s);
+    nv_pmc_apply(s);
+    return 0;
 }
 
+/*
+ * Display and register state.  Channels and graphics contexts aren't
+ * included, migration is blocked while any channel is in DMA mode, so a
+ * snapshot is taken e.g. for a template at the boot display.
+ */
+static const VMStateDescription vmstate_geforce3 = {
+    .name = "geforce3",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = nv_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_PCI_DEVICE(parent_obj, NVGFState),
+        VMSTATE_STRUCT(vga, NVGFState, 0, vmstate_vga_common,
+                       VGACommonState),
+        VMSTATE_UINT8(ddc_state, NVGFState),
+        VMSTATE_UINT32_ARRAY(prmvio, NVGFState, NV_PRMVIO_SIZE / 4),
+        VMSTATE_UINT16(vbe_index, NVGFState),
+        VMSTATE_UINT16_ARRAY(vbe_regs, NVGFState, 16),
+        VMSTATE_UINT32(pmc_intr_0, NVGFState),
+        VMSTATE_UINT32(pmc_intr_en_0, NVGFState),
+        VMSTATE_UINT32(pmc_enable, NVGFState),
+        VMSTATE_UINT32_ARRAY(pfb, NVGFState, NV_PFB_SIZE / 4),
+        VMSTATE_UINT32(pfifo.intr, NVGFState),
+        VMSTATE_UINT32(pfifo.intr_en, NVGFState),
+        VMSTATE_UINT32_ARRAY(pfifo.regs, NVGFState, NV_PFIFO_SIZE / 4),
+        VMSTATE_UINT32(pgraph.intr, NVGFState),
+        VMSTATE_UINT32(pgraph.intr_en, NVGFState),
+        VMSTATE_UINT32_ARRAY(pgraph.regs, NVGFState, NV_PGRAPH_SIZE / 4),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 /* FIX: Update function signature to match expected prototype for class_init */
 static void nv_class_init(ObjectClass *klass, const void *data)
 {
@@ -426,6 +4263,7 @@ static void nv_class_init(ObjectClass *klass, const void *data)
     PCIDeviceClass *k = PCI_DEVICE_CLASS(klass);
     
     k->realize = nv_realize;
+    k->exit = nv_exit;
     k->vendor_id = NVIDIA_VENDOR_ID;
     k->device_id = GEFORCE3_DEVICE_ID;
     k->class_id = PCI_CLASS_DISPLAY_VGA;
@@ -433,10 +4271,11 @@ static void nv_class_init(ObjectClass *klass, const void *data)
     k->subsystem_id = GEFORCE3_DEVICE_ID;
     
     dc->desc = "NVIDIA GeForce3 Graphics Card";
-    /* FIX: Modern QEMU uses device_class_set_parent_reset instead of dc->reset */
-    /* dc->reset = vga_common_reset; */ /* Removed to fix "no member named 'reset'" error */
-    dc->vmsd = &vmstate_vga_common;
+    /* FIX: Modern QEMU has no dc->reset, register through the legacy helper */
+    device_class_set_legacy_reset(dc, nv_reset);
+    dc->vmsd = &vmstate_geforce3;
     dc->hotpluggable = false;
+    device_class_set_props(dc, nv_properties);
     
     set_bit(DEVICE_CATEGORY_DISPLAY, dc->categories);
 }
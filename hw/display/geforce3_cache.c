@@ -0,0 +1,197 @@
+/*
+ * NVIDIA GeForce3 decode caches
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
+#include "geforce3_cache.h"
+
+#define NV_HASH_PRIME1          0x9e3779b185ebca87ULL
+#define NV_HASH_PRIME2          0xc2b2ae3d27d4eb4fULL
+#define NV_HASH_PRIME3          0x165667b19e3779f9ULL
+
+struct NVCacheTable {
+    int refcount;
+    bool shared;
+    QemuMutex lock;
+    GHashTable *entries; /* id -> NVCacheEntry */
+};
+
+/* Process-wide instance, only touched from realize/exit under the BQL */
+static NVCacheTable *nv_shared_table;
+
+static inline uint64_t nv_hash_round(uint64_t h, uint64_t k)
+{
+    return (h ^ (rol64(k * NV_HASH_PRIME2, 31) * NV_HASH_PRIME1)) *
+           NV_HASH_PRIME3;
+}
+
+uint64_t nv_hash64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data;
+    uint64_t h = seed ^ (len * NV_HASH_PRIME1);
+    uint64_t tail = 0;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        h = nv_hash_round(h, ldq_le_p(p));
+    }
+    if (len) {
+        memcpy(&tail, p, len);
+        h = nv_hash_round(h, le64_to_cpu(tail));
+    }
+
+    h ^= h >> 33;
+    h *= NV_HASH_PRIME2;
+    h ^= h >> 29;
+    h *= NV_HASH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+/*
+ * Hash table key.  Kinds never alias, and entries also match on their
+ * size, so a hash collision between different content has to hit the
+ * same size too.
+ */
+typedef struct NVCacheId {
+    uint64_t key;
+    size_t size;
+    NVCacheKind kind;
+} NVCacheId;
+
+static inline NVCacheId nv_cache_id(NVCacheKind kind, uint64_t key,
+                                    size_t size)
+{
+    return (NVCacheId) { .key = key, .size = size, .kind = kind };
+}
+
+static guint nv_cache_id_hash(gconstpointer p)
+{
+    const NVCacheId *id = p;
+
+    return (guint)(id->key ^ (id->key >> 32)) ^ id->kind;
+}
+
+static gboolean nv_cache_id_equal(gconstpointer a, gconstpointer b)
+{
+    const NVCacheId *x = a, *y = b;
+
+    return x->key == y->key && x->size == y->size && x->kind == y->kind;
+}
+
+NVCacheTable *nv_cache_table_new(void)
+{
+    NVCacheTable *t = g_new0(NVCacheTable, 1);
+
+    t->refcount = 1;
+    qemu_mutex_init(&t->lock);
+    t->entries = g_hash_table_new_full(nv_cache_id_hash, nv_cache_id_equal, g_free,
+                                       NULL);
+    return t;
+}
+
+NVCacheTable *nv_cache_table_shared(void)
+{
+    if (nv_shared_table) {
+        nv_shared_table->refcount++;
+    } else {
+        nv_shared_table = nv_cache_table_new();
+        nv_shared_table->shared = true;
+    }
+    return nv_shared_table;
+}
+
+void nv_cache_table_unref(NVCacheTable *t)
+{
+    if (!t || --t->refcount) {
+        return;
+    }
+
+    /* Every device releases its entries before dropping the table */
+    assert(g_hash_table_size(t->entries) == 0);
+    if (t->shared) {
+        nv_shared_table = NULL;
+    }
+    g_hash_table_destroy(t->entries);
+    qemu_mutex_destroy(&t->lock);
+    g_free(t);
+}
+
+NVCacheEntry *nv_cache_lookup(NVCacheTable *t, NVCacheKind kind, uint64_t key,
+                              size_t size)
+{
+    NVCacheId id = nv_cache_id(kind, key, size);
+    NVCacheEntry *e;
+
+    QEMU_LOCK_GUARD(&t->lock);
+
+    e = g_hash_table_lookup(t->entries, &id);
+    if (e) {
+        e->refcount++;
+    }
+    return e;
+}
+
+NVCacheEntry *nv_cache_insert(NVCacheTable *t, NVCacheKind kind, uint64_t key,
+                              void *data, size_t size)
+{
+    NVCacheId id = nv_cache_id(kind, key, size);
+    NVCacheEntry *e;
+
+    QEMU_LOCK_GUARD(&t->lock);
+
+    /* Another user may have produced the same content in the meantime */
+    e = g_hash_table_lookup(t->entries, &id);
+    if (e) {
+        g_free(data);
+        e->refcount++;
+        return e;
+    }
+
+    e = g_new0(NVCacheEntry, 1);
+    e->table = t;
+    e->kind = kind;
+    e->key = key;
+    e->refcount = 1;
+    e->size = size;
+    e->data = data;
+    g_hash_table_insert(t->entries, g_memdup2(&id, sizeof(id)), e);
+    return e;
+}
+
+NVCacheEntry *nv_cache_entry_ref(NVCacheEntry *e)
+{
+    QEMU_LOCK_GUARD(&e->table->lock);
+
+    e->refcount++;
+    return e;
+}
+
+void nv_cache_entry_unref(NVCacheEntry *e)
+{
+    NVCacheTable *t;
+    NVCacheId id;
+
+    if (!e) {
+        return;
+    }
+
+    t = e->table;
+    id = nv_cache_id(e->kind, e->key, e->size);
+    WITH_QEMU_LOCK_GUARD(&t->lock) {
+        if (--e->refcount) {
+            return;
+        }
+        g_hash_table_remove(t->entries, &id);
+    }
+    g_free(e->data);
+    g_free(e);
+}
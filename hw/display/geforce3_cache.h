@@ -0,0 +1,50 @@
+/*
+ * NVIDIA GeForce3 decode caches
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GEFORCE3_CACHE_H
+#define GEFORCE3_CACHE_H
+
+typedef enum NVCacheKind {
+    NV_CACHE_TEXTURE = 1,
+} NVCacheKind;
+
+typedef struct NVCacheTable NVCacheTable;
+
+/* Content-addressed, reference counted blob; data is immutable */
+typedef struct NVCacheEntry {
+    NVCacheTable *table;
+    NVCacheKind kind;
+    uint64_t key;
+    int refcount;
+    size_t size;
+    void *data;
+} NVCacheEntry;
+
+/* Content hash used to key every cache in the device */
+uint64_t nv_hash64(const void *data, size_t len, uint64_t seed);
+
+/*
+ * In-memory cache of decoded textures.  The shared table is process
+ * wide, so every device instance and head looking up the same content
+ * gets the same entry.  Entries are identified by kind,
+ * key and size, and are dropped once the last reference goes away.
+ */
+NVCacheTable *nv_cache_table_new(void);
+NVCacheTable *nv_cache_table_shared(void);
+void nv_cache_table_unref(NVCacheTable *t);
+NVCacheEntry *nv_cache_lookup(NVCacheTable *t, NVCacheKind kind, uint64_t key,
+                              size_t size);
+NVCacheEntry *nv_cache_insert(NVCacheTable *t, NVCacheKind kind, uint64_t key,
+                              void *data, size_t size);
+NVCacheEntry *nv_cache_entry_ref(NVCacheEntry *e);
+void nv_cache_entry_unref(NVCacheEntry *e);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * NVIDIA GeForce3 geometry and raster engine
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GEFORCE3_ENGINE_H
+#define GEFORCE3_ENGINE_H
+
+/*
+ * The engine only works on plain host memory and the structures below; it
+ * knows nothing about the device, its registers or guest memory.
+ */
+
+/*
+ * Vertices are processed this many at a time, one per SIMD lane, and
+ * fragments a 2x2 quad at a time.  Kernels built for wider vectors take
+ * several batches at once, see nv_sample_pair().
+ */
+#define NV_ENGINE_BATCH         4
+#define NV_ENGINE_ATTRIBS       16
+#define NV_ENGINE_TEXTURES      4
+#define NV_ENGINE_LIGHTS        8
+
+/* Raster work is split into square tiles of this many pixels */
+#define NV_TILE_SHIFT           6
+#define NV_TILE_SIZE            (1 << NV_TILE_SHIFT)
+
+/* Vertex attribute slots */
+#define NV_ATTR_POSITION        0
+#define NV_ATTR_WEIGHT          1
+#define NV_ATTR_NORMAL          2
+#define NV_ATTR_DIFFUSE         3
+#define NV_ATTR_SPECULAR        4
+#define NV_ATTR_FOG             5
+#define NV_ATTR_POINT_SIZE      6
+#define NV_ATTR_BACK_DIFFUSE    7
+#define NV_ATTR_BACK_SPECULAR   8
+#define NV_ATTR_TEXTURE0        9
+
+typedef float NVVecF __attribute__((vector_size(NV_ENGINE_BATCH * 4)));
+typedef int32_t NVVecI __attribute__((vector_size(NV_ENGINE_BATCH * 4)));
+
+/* Per-lane select and clamps; comparisons yield all-ones lane masks */
+static inline NVVecF nv_vsel(NVVecI mask, NVVecF a, NVVecF b)
+{
+    return (NVVecF)((mask & (NVVecI)a) | (~mask & (NVVecI)b));
+}
+
+static inline NVVecF nv_vmax(NVVecF a, NVVecF b)
+{
+    return nv_vsel(a > b, a, b);
+}
+
+static inline NVVecF nv_vmin(NVVecF a, NVVecF b)
+{
+    return nv_vsel(a < b, a, b);
+}
+
+/* Lane-wise conversions, truncating towards zero like a C cast */
+#if __has_builtin(__builtin_convertvector)
+static inline NVVecF nv_vcvt(NVVecI a)
+{
+    return __builtin_convertvector(a, NVVecF);
+}
+
+static inline NVVecI nv_vcvti(NVVecF a)
+{
+    return __builtin_convertvector(a, NVVecI);
+}
+#else
+static inline NVVecF nv_vcvt(NVVecI a)
+{
+    NVVecF f;
+    int i;
+
+    for (i = 0; i < NV_ENGINE_BATCH; i++) {
+        f[i] = a[i];
+    }
+    return f;
+}
+
+static inline NVVecI nv_vcvti(NVVecF a)
+{
+    NVVecI v;
+    int i;
+
+    for (i = 0; i < NV_ENGINE_BATCH; i++) {
+        v[i] = a[i];
+    }
+    return v;
+}
+#endif
+
+/* NaN lanes come out unchanged, see nv_vsel() */
+static inline NVVecF nv_vclamp(NVVecF a, float lo, float hi)
+{
+    NVVecF zero = { }, vlo = zero + lo, vhi = zero + hi;
+
+    return nv_vsel(a < vlo, vlo, nv_vsel(a > vhi, vhi, a));
+}
+
+/* Fetched vertex attributes, structure of arrays: [attrib][component] */
+typedef struct NVAttribBatch {
+    NVVecF v[NV_ENGINE_ATTRIBS][4];
+    unsigned count;
+} NVAttribBatch;
+
+/* Attribute formats, as in SET_VERTEX_DATA_ARRAY_FORMAT */
+#define NV_ATTRIB_UB_D3D        0   /* unsigned bytes, BGRA order */
+#define NV_ATTRIB_S1            1   /* normalized shorts */
+#define NV_ATTRIB_F             2   /* floats */
+#define NV_ATTRIB_UB_OGL        4   /* unsigned bytes, RGBA order */
+#define NV_ATTRIB_S32K          5   /* unnormalized shorts */
+#define NV_ATTRIB_CMP           6   /* packed 11:11:10 normal */
+
+/* One vertex array in host memory */
+typedef struct NVAttribStream {
+    const uint8_t *base;
+    unsigned stride;
+    uint32_t type;
+    unsigned count;         /* components */
+} NVAttribStream;
+
+/* Bytes of one element, 0 for unknown formats and more than 4 components */
+unsigned nv_attrib_size(uint32_t type, unsigned count);
+
+/*
+ * Decode elements @index[0..n) of @a into lanes 0..n-1 of @out.  Missing
+ * components read as 0, except w which reads as 1.
+ */
+void nv_fetch_attrib(const NVAttribStream *a, const uint32_t *index,
+                     unsigned n, NVVecF out[4]);
+
+/* Transformed vertex, ready for setup */
+typedef struct NVVertex {
+    float x, y, z;          /* window coordinates */
+    float iw;               /* 1 / clip w, 0 if behind the eye */
+    float color[4];         /* diffuse r, g, b, a */
+    float spec[4];
+    float tex[NV_ENGINE_TEXTURES][4];
+} NVVertex;
+
+/* Infinite light, in eye space */
+typedef struct NVLight {
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float dir[3];           /* towards the light */
+    float half[3];
+} NVLight;
+
+/*
+ * Fixed function transform and lighting state.  Matrices are row major
+ * and multiply row vectors: out[j] = sum(in[i] * m[i * 4 + j]).  The
+ * composite matrix includes the viewport scale, the offset is added after
+ * the perspective divide.
+ */
+typedef struct NVTnLState {
+    float composite[16];
+    float modelview[16];
+    float inv_modelview[16];
+    float viewport_offset[4];
+
+    bool lighting;
+    bool normalize;
+    bool diffuse_from_vertex;
+    unsigned num_lights;
+    NVLight light[NV_ENGINE_LIGHTS];
+    float scene_ambient[3];
+    float emission[3];
+    float material_alpha;
+
+    bool texgen;            /* any stage has texgen or a texture matrix */
+    uint32_t texgen_mode[NV_ENGINE_TEXTURES][4];
+    float texgen_plane[NV_ENGINE_TEXTURES][4][4];
+    bool texture_matrix_enable[NV_ENGINE_TEXTURES];
+    float texture_matrix[NV_ENGINE_TEXTURES][16];
+} NVTnLState;
+
+/* Texture coordinate generation modes, GL enums */
+#define NV_TEXGEN_DISABLE       0x0000
+#define NV_TEXGEN_EYE_LINEAR    0x2400
+#define NV_TEXGEN_OBJECT_LINEAR 0x2401
+
+typedef void NVTnLFn(const NVTnLState *st, const NVAttribBatch *in,
+                     NVVertex *out);
+
+/* Kernel specialized for the lighting and texgen state in @st */
+NVTnLFn *nv_tnl_select(const NVTnLState *st);
+
+/* Color and depth buffers in host memory */
+typedef struct NVRenderTarget {
+    uint8_t *color;
+    unsigned color_pitch;
+    unsigned color_bpp;     /* 2 (R5G6B5) or 4 (A8R8G8B8) */
+    uint8_t *zeta;          /* NULL without a depth buffer */
+    unsigned zeta_pitch;
+    unsigned zeta_bpp;      /* 2 (Z16) or 4 (Z24S8) */
+    int x0, y0, x1, y1;     /* drawable rectangle, exclusive */
+} NVRenderTarget;
+
+/* Texture address modes, as in SET_TEXTURE_ADDRESS */
+#define NV_TEX_WRAP             1
+#define NV_TEX_MIRROR           2
+#define NV_TEX_CLAMP            3
+#define NV_TEX_BORDER           4
+#define NV_TEX_CLAMP_OGL        5
+
+/* Texture filters, as in SET_TEXTURE_FILTER */
+#define NV_TEX_NEAREST                  1
+#define NV_TEX_LINEAR                   2
+#define NV_TEX_NEAREST_MIPMAP_NEAREST   3
+#define NV_TEX_LINEAR_MIPMAP_NEAREST    4
+#define NV_TEX_NEAREST_MIPMAP_LINEAR    5
+#define NV_TEX_LINEAR_MIPMAP_LINEAR     6
+
+#define NV_TEX_MAX_LEVELS       16
+
+/* Guest texel and pixel formats, decoded to A8R8G8B8 */
+#define NV_TEXEL_L8             0   /* luminance, opaque */
+#define NV_TEXEL_AL8            1   /* luminance, also in alpha */
+#define NV_TEXEL_A8             2
+#define NV_TEXEL_A1R5G5B5       3
+#define NV_TEXEL_X1R5G5B5       4
+#define NV_TEXEL_A4R4G4B4       5
+#define NV_TEXEL_R5G6B5         6
+#define NV_TEXEL_A8R8G8B8       7
+#define NV_TEXEL_X8R8G8B8       8
+#define NV_TEXEL_R16            9   /* passed through, e.g. depth */
+#define NV_TEXEL_R32            10
+
+/* Bytes per texel, 0 for unknown formats */
+unsigned nv_texel_size(unsigned format);
+
+/* Texture image in guest memory */
+typedef struct NVTextureImage {
+    unsigned format;        /* NV_TEXEL_* */
+    bool swizzled;          /* all levels, else level 0 only */
+    unsigned width, height, levels;
+    unsigned pitch;         /* bytes per row, at least width texels */
+} NVTextureImage;
+
+/* Bytes of guest memory that @img spans */
+size_t nv_texture_image_size(const NVTextureImage *img);
+
+/* Bytes of the decoded A8R8G8B8 image of @img */
+size_t nv_texture_decoded_size(const NVTextureImage *img);
+
+/*
+ * Decode @img from @raw into newly allocated A8R8G8B8 texels, the mip
+ * levels one after another as NVTexture expects.  The allocation size is
+ * returned in @size; free with g_free().
+ */
+uint32_t *nv_texture_decode(const NVTextureImage *img, const uint8_t *raw,
+                            size_t *size);
+
+/*
+ * Convert @n pixels of 16 or 32 bit formats.  Pixels are decoded to
+ * A8R8G8B8 and packed into R5G6B5, or X1R5G5B5 for any other 16 bit
+ * format.  The same format, any two 32 bit formats and raw 16 bit data
+ * are copied as is.
+ */
+void nv_convert_pixels(uint8_t *dst, unsigned dst_format, const uint8_t *src,
+                       unsigned src_format, unsigned n);
+
+/* Decoded texture: A8R8G8B8 texels, the mip levels one after another */
+typedef struct NVTexture {
+    const uint32_t *texels;     /* NULL if the stage is disabled */
+    unsigned width, height, levels;
+    uint32_t level_offset[NV_TEX_MAX_LEVELS];   /* in texels */
+    unsigned stride;            /* texels per row of level 0 */
+    uint32_t force;             /* ORed into every texel, e.g. opaque alpha */
+    bool normalized;            /* false for linear textures, in texels */
+    unsigned wrap_u, wrap_v;
+    uint32_t border;
+    unsigned min_filter, mag_filter;
+    float lod_bias;
+    float min_lod, max_lod;
+    unsigned max_aniso;         /* samples along the axis of anisotropy */
+
+    /* Depth textures compare r against (texel >> depth_shift) & depth_max */
+    bool shadow;
+    unsigned shadow_func;
+    unsigned depth_shift;
+    uint32_t depth_max;
+} NVTexture;
+
+/*
+ * Filter @tex for a 2x2 pixel quad.  Lane i samples at (coord[0][i],
+ * coord[1][i]); lanes 0-1 and 0-2 are horizontal and vertical neighbours,
+ * and their differences select the mip level and the anisotropy.  Depth
+ * textures return the filtered result of comparing coord[2] in [0, 1]
+ * with each texel.  Uses the widest kernel the host CPU supports.
+ */
+void nv_sample_quad(const NVTexture *tex, const NVVecF coord[3],
+                    NVVecF out[4]);
+
+/*
+ * nv_sample_quad() for two quads, which hosts with AVX2 filter as one
+ * 8-lane span when they share the mip level and the anisotropy.
+ */
+void nv_sample_pair(const NVTexture *tex, const NVVecF coord[2][3],
+                    NVVecF out[2][4]);
+
+/* Per-fragment operations, comparison functions are GL enums & 7 */
+typedef struct NVRasterOps {
+    bool cull_front;
+    bool cull_back;
+    bool front_ccw;
+    bool flat;
+
+    bool depth_test;
+    bool depth_write;
+    unsigned depth_func;
+    float depth_min;
+    float depth_max;
+
+    bool alpha_test;
+    unsigned alpha_func;
+    float alpha_ref;
+
+    bool blend;
+    uint32_t sfactor;
+    uint32_t dfactor;
+    uint32_t equation;
+    float blend_color[4];
+    uint32_t write_mask;    /* A8R8G8B8 lanes that are written */
+
+    NVTexture tex[NV_ENGINE_TEXTURES];
+} NVRasterOps;
+
+#define NV_FUNC_NEVER           0
+#define NV_FUNC_LESS            1
+#define NV_FUNC_EQUAL           2
+#define NV_FUNC_LEQUAL          3
+#define NV_FUNC_GREATER         4
+#define NV_FUNC_NOTEQUAL        5
+#define NV_FUNC_GEQUAL          6
+#define NV_FUNC_ALWAYS          7
+
+/* Triangle after setup: barycentric planes and bounds */
+typedef struct NVTriangle {
+    NVVertex v[3];
+    float bary[3][3];       /* weight of v[i] is a * x + b * y + c */
+    int x0, y0, x1, y1;     /* bounding box clipped to the target */
+} NVTriangle;
+
+/*
+ * Set up triangles @prim[0..n), given as indices into @v, into @out and
+ * return how many were kept.  Triangles reaching behind the eye,
+ * degenerate, culled by facing or outside @rt are rejected a batch at a
+ * time, before any per-triangle work.  Survivors keep their order.
+ */
+unsigned nv_setup_triangles(NVTriangle *out, const NVVertex *v,
+                            const uint32_t (*prim)[3], unsigned n,
+                            const NVRenderTarget *rt, const NVRasterOps *ops);
+
+/*
+ * Rasterize triangles @list[0..n) in order, clipped to the tile at
+ * (@tx, @ty).  Tiles don't share pixels, so they can run in parallel.
+ * Returns the number of fragments that passed every test.
+ */
+unsigned nv_raster_tile(const NVRenderTarget *rt, const NVRasterOps *ops,
+                        const NVTriangle *tris, const uint32_t *list,
+                        unsigned n, unsigned tx, unsigned ty);
+
+#endif
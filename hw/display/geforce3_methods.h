@@ -0,0 +1,482 @@
+/*
+ * NVIDIA GeForce3 object classes and their methods
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GEFORCE3_METHODS_H
+#define GEFORCE3_METHODS_H
+
+/*
+ * Each class is described by a list of X(method, count, handler) entries.
+ * geforce3.c expands every list into a dense, constant table indexed by
+ * method offset / 4, so dispatching a method is a single indexed call no
+ * matter how many classes or methods exist.  Methods missing from a list
+ * are logged as unimplemented.
+ *
+ * The optional bulk list names methods whose payload is a data stream.
+ * When the pushbuffer carries a run of them, the whole contiguous run is
+ * handed to the bulk handler in one call instead of word by word.
+ */
+#define NV_METHOD_TABLE_SIZE    (0x2000 / 4)
+
+/* Object classes */
+#define NV03_MEMORY_TO_MEMORY_FORMAT    0x0039
+#define NV04_CONTEXT_SURFACES_2D        0x0042
+#define NV04_IMAGE_FROM_CPU             0x0061
+#define NV10_CONTEXT_SURFACES_2D        0x0062
+#define NV20_KELVIN_PRIMITIVE           0x0097
+
+/* Methods shared by all classes */
+#define NV_NO_OPERATION                 0x0100
+#define NV_NOTIFY                       0x0104
+#define NV_WAIT_FOR_IDLE                0x0110
+#define NV_SET_CONTEXT_DMA_NOTIFIES     0x0180
+
+/* NV03_MEMORY_TO_MEMORY_FORMAT */
+#define NV039_SET_CONTEXT_DMA_BUFFER_IN     0x0184
+#define NV039_SET_CONTEXT_DMA_BUFFER_OUT    0x0188
+#define NV039_OFFSET_IN                     0x030c
+#define NV039_OFFSET_OUT                    0x0310
+#define NV039_PITCH_IN                      0x0314
+#define NV039_PITCH_OUT                     0x0318
+#define NV039_LINE_LENGTH_IN                0x031c
+#define NV039_LINE_COUNT                    0x0320
+#define NV039_FORMAT                        0x0324
+#define NV039_BUFFER_NOTIFY                 0x0328
+#define   NV039_FORMAT_BYTES                  0x101
+
+/* NV04/NV10_CONTEXT_SURFACES_2D */
+#define NV042_SET_CONTEXT_DMA_IMAGE_SOURCE  0x0184
+#define NV042_SET_CONTEXT_DMA_IMAGE_DESTIN  0x0188
+#define NV042_SET_COLOR_FORMAT              0x0300
+#define NV042_SET_PITCH                     0x0304
+#define NV042_SET_OFFSET_SOURCE             0x0308
+#define NV042_SET_OFFSET_DESTIN             0x030c
+#define   NV042_COLOR_FORMAT_Y8               0x01
+#define   NV042_COLOR_FORMAT_X1R5G5B5_Z1      0x02
+#define   NV042_COLOR_FORMAT_X1R5G5B5_O1      0x03
+#define   NV042_COLOR_FORMAT_R5G6B5           0x04
+#define   NV042_COLOR_FORMAT_Y16              0x05
+#define   NV042_COLOR_FORMAT_X8R8G8B8_Z8      0x06
+#define   NV042_COLOR_FORMAT_X8R8G8B8_O8      0x07
+#define   NV042_COLOR_FORMAT_A8R8G8B8         0x0a
+#define   NV042_COLOR_FORMAT_Y32              0x0b
+
+/* NV04_IMAGE_FROM_CPU */
+#define NV061_SET_CONTEXT_COLOR_KEY         0x0184
+#define NV061_SET_CONTEXT_CLIP_RECTANGLE    0x0188
+#define NV061_SET_CONTEXT_PATTERN           0x018c
+#define NV061_SET_CONTEXT_ROP               0x0190
+#define NV061_SET_CONTEXT_BETA1             0x0194
+#define NV061_SET_CONTEXT_BETA4             0x0198
+#define NV061_SET_CONTEXT_SURFACE           0x019c
+#define NV061_SET_OPERATION                 0x02fc
+#define NV061_SET_COLOR_FORMAT              0x0300
+#define NV061_POINT                         0x0304
+#define NV061_SIZE_OUT                      0x0308
+#define NV061_SIZE_IN                       0x030c
+#define NV061_COLOR                         0x0400
+#define NV061_COLOR_COUNT                   0x100
+#define   NV061_COLOR_FORMAT_R5G6B5           0x1
+#define   NV061_COLOR_FORMAT_A1R5G5B5         0x2
+#define   NV061_COLOR_FORMAT_X1R5G5B5         0x3
+#define   NV061_COLOR_FORMAT_A8R8G8B8         0x4
+#define   NV061_COLOR_FORMAT_X8R8G8B8         0x5
+
+/* NV20_KELVIN_PRIMITIVE */
+#define NV097_SET_FLIP_READ                 0x0120
+#define NV097_SET_CONTEXT_DMA_A             0x0184
+#define NV097_SET_CONTEXT_DMA_B             0x0188
+#define NV097_SET_CONTEXT_DMA_STATE         0x0190
+#define NV097_SET_CONTEXT_DMA_COLOR         0x0194
+#define NV097_SET_CONTEXT_DMA_ZETA          0x0198
+#define NV097_SET_CONTEXT_DMA_VERTEX_A      0x019c
+#define NV097_SET_CONTEXT_DMA_VERTEX_B      0x01a0
+#define NV097_SET_CONTEXT_DMA_SEMAPHORE     0x01a4
+#define NV097_SET_CONTEXT_DMA_REPORT        0x01a8
+#define NV097_SET_SURFACE_CLIP_HORIZONTAL   0x0200
+#define NV097_SET_SURFACE_CLIP_VERTICAL     0x0204
+#define NV097_SET_SURFACE_FORMAT            0x0208
+#define NV097_SET_SURFACE_PITCH             0x020c
+#define NV097_SET_SURFACE_COLOR_OFFSET      0x0210
+#define NV097_SET_SURFACE_ZETA_OFFSET       0x0214
+#define NV097_SET_COMBINER_ALPHA_ICW        0x0260
+#define NV097_SET_COMBINER_SPECULAR_FOG_CW0 0x0288
+#define NV097_SET_CONTROL0                  0x0290
+#define NV097_SET_LIGHT_CONTROL             0x0294
+#define NV097_SET_COLOR_MATERIAL            0x0298
+#define NV097_SET_FOG_MODE                  0x029c
+#define NV097_SET_FOG_COLOR                 0x02a8
+#define NV097_SET_WINDOW_CLIP_TYPE          0x02b4
+#define   NV097_WINDOW_CLIP_TYPE_INCLUSIVE    0x0
+#define NV097_SET_WINDOW_CLIP_HORIZONTAL    0x02c0
+#define NV097_SET_WINDOW_CLIP_VERTICAL      0x02e0
+#define NV097_SET_ALPHA_TEST_ENABLE         0x0300
+#define NV097_SET_BLEND_ENABLE              0x0304
+#define NV097_SET_CULL_FACE_ENABLE          0x0308
+#define NV097_SET_DEPTH_TEST_ENABLE         0x030c
+#define NV097_SET_DITHER_ENABLE             0x0310
+#define NV097_SET_LIGHTING_ENABLE           0x0314
+#define NV097_SET_STENCIL_TEST_ENABLE       0x032c
+#define NV097_SET_ALPHA_FUNC                0x033c
+#define NV097_SET_ALPHA_REF                 0x0340
+#define NV097_SET_BLEND_FUNC_SFACTOR        0x0344
+#define NV097_SET_BLEND_FUNC_DFACTOR        0x0348
+#define NV097_SET_BLEND_COLOR               0x034c
+#define NV097_SET_BLEND_EQUATION            0x0350
+#define NV097_SET_DEPTH_FUNC                0x0354
+#define NV097_SET_COLOR_MASK                0x0358
+#define NV097_SET_DEPTH_MASK                0x035c
+#define NV097_SET_STENCIL_MASK              0x0360
+#define NV097_SET_STENCIL_FUNC              0x0364
+#define NV097_SET_STENCIL_FUNC_REF          0x0368
+#define NV097_SET_STENCIL_FUNC_MASK         0x036c
+#define NV097_SET_STENCIL_OP_FAIL           0x0370
+#define NV097_SET_STENCIL_OP_ZFAIL          0x0374
+#define NV097_SET_STENCIL_OP_ZPASS          0x0378
+#define NV097_SET_SHADE_MODE                0x037c
+#define NV097_SET_FRONT_POLYGON_MODE        0x038c
+#define NV097_SET_BACK_POLYGON_MODE         0x0390
+#define NV097_SET_CLIP_MIN                  0x0394
+#define NV097_SET_CLIP_MAX                  0x0398
+#define NV097_SET_CULL_FACE                 0x039c
+#define NV097_SET_FRONT_FACE                0x03a0
+#define NV097_SET_NORMALIZATION_ENABLE      0x03a4
+#define NV097_SET_MATERIAL_EMISSION         0x03a8
+#define NV097_SET_MATERIAL_ALPHA            0x03b4
+#define NV097_SET_SPECULAR_ENABLE           0x03b8
+#define NV097_SET_LIGHT_ENABLE_MASK         0x03bc
+#define NV097_SET_TEXGEN_S                  0x03c0
+#define NV097_SET_TEXTURE_MATRIX_ENABLE     0x0420
+#define NV097_SET_POINT_SIZE                0x043c
+#define NV097_SET_PROJECTION_MATRIX         0x0440
+#define NV097_SET_MODEL_VIEW_MATRIX         0x0480
+#define NV097_SET_INVERSE_MODEL_VIEW_MATRIX 0x0580
+#define NV097_SET_COMPOSITE_MATRIX          0x0680
+#define NV097_SET_TEXTURE_MATRIX            0x06c0
+#define NV097_SET_TEXGEN_PLANE_S            0x0840
+#define NV097_SET_FOG_PARAMS                0x09c0
+#define NV097_SET_FOG_PLANE                 0x09d0
+#define NV097_SET_SCENE_AMBIENT_COLOR       0x0a10
+#define NV097_SET_VIEWPORT_OFFSET           0x0a20
+#define NV097_SET_POINT_PARAMS              0x0a30
+#define NV097_SET_EYE_POSITION              0x0a50
+#define NV097_SET_COMBINER_FACTOR0          0x0a60
+#define NV097_SET_COMBINER_FACTOR1          0x0a80
+#define NV097_SET_COMBINER_ALPHA_OCW        0x0aa0
+#define NV097_SET_COMBINER_COLOR_ICW        0x0ac0
+#define NV097_SET_COLOR_KEY_COLOR           0x0ae0
+#define NV097_SET_VIEWPORT_SCALE            0x0af0
+#define NV097_SET_TRANSFORM_PROGRAM         0x0b00
+#define NV097_SET_TRANSFORM_CONSTANT        0x0b80
+#define NV097_SET_BACK_LIGHT                0x0c00
+#define NV097_SET_LIGHT                     0x1000
+#define NV097_SET_STIPPLE_CONTROL           0x147c
+#define NV097_SET_STIPPLE_PATTERN           0x1480
+#define NV097_SET_VERTEX3F                  0x1500
+#define NV097_SET_VERTEX_DATA_ARRAY_OFFSET  0x1720
+#define NV097_SET_VERTEX_DATA_ARRAY_FORMAT  0x1760
+#define NV097_SET_LOGIC_OP_ENABLE           0x17bc
+#define NV097_SET_LOGIC_OP                  0x17c0
+#define NV097_CLEAR_REPORT_VALUE            0x17c8
+#define NV097_SET_ZPASS_PIXEL_COUNT_ENABLE  0x17cc
+#define NV097_GET_REPORT                    0x17d0
+#define NV097_SET_EYE_DIRECTION             0x17e0
+#define NV097_SET_SHADER_CLIP_PLANE_MODE    0x17f8
+#define NV097_SET_BEGIN_END                 0x17fc
+#define NV097_ARRAY_ELEMENT16               0x1800
+#define NV097_ARRAY_ELEMENT32               0x1808
+#define NV097_DRAW_ARRAYS                   0x1810
+#define NV097_INLINE_ARRAY                  0x1818
+#define NV097_SET_VERTEX_DATA2F_M           0x1880
+#define NV097_SET_TEXTURE_OFFSET            0x1b00
+#define NV097_SET_TEXTURE_FORMAT            0x1b04
+#define NV097_SET_TEXTURE_ADDRESS           0x1b08
+#define NV097_SET_TEXTURE_CONTROL0          0x1b0c
+#define NV097_SET_TEXTURE_CONTROL1          0x1b10
+#define NV097_SET_TEXTURE_FILTER            0x1b14
+#define NV097_SET_TEXTURE_IMAGE_RECT        0x1b1c
+#define NV097_SET_TEXTURE_PALETTE           0x1b20
+#define NV097_SET_TEXTURE_BORDER_COLOR      0x1b24
+#define NV097_SET_TEXTURE_STAGE_SIZE        0x40
+#define NV097_SET_SEMAPHORE_OFFSET          0x1d6c
+#define NV097_BACK_END_WRITE_SEMAPHORE_RELEASE 0x1d70
+#define NV097_SET_ZMIN_MAX_CONTROL          0x1d78
+#define NV097_SET_ANTI_ALIASING_CONTROL     0x1d7c
+#define NV097_SET_COMPRESS_ZBUFFER_EN       0x1d80
+#define NV097_SET_OCCLUDE_ZSTENCIL_EN       0x1d84
+#define NV097_SET_ZSTENCIL_CLEAR_VALUE      0x1d8c
+#define NV097_SET_COLOR_CLEAR_VALUE         0x1d90
+#define NV097_CLEAR_SURFACE                 0x1d94
+#define NV097_SET_CLEAR_RECT_HORIZONTAL     0x1d98
+#define NV097_SET_CLEAR_RECT_VERTICAL       0x1d9c
+#define NV097_SET_SPECULAR_FOG_FACTOR       0x1e20
+#define NV097_SET_COMBINER_COLOR_OCW        0x1e40
+#define NV097_SET_COMBINER_CONTROL          0x1e60
+#define NV097_SET_SHADOW_ZSLOPE_THRESHOLD   0x1e68
+#define NV097_SET_SHADOW_DEPTH_FUNC         0x1e6c
+#define NV097_SET_SHADER_STAGE_PROGRAM      0x1e70
+#define NV097_SET_DOT_RGBMAPPING            0x1e74
+#define NV097_SET_SHADER_OTHER_STAGE_INPUT  0x1e78
+#define NV097_SET_TRANSFORM_DATA            0x1e80
+#define NV097_LAUNCH_TRANSFORM_PROGRAM      0x1e90
+#define NV097_SET_TRANSFORM_EXECUTION_MODE  0x1e94
+#define NV097_SET_TRANSFORM_PROGRAM_CXT_WRITE_EN 0x1e98
+#define NV097_SET_TRANSFORM_PROGRAM_LOAD    0x1e9c
+#define NV097_SET_TRANSFORM_PROGRAM_START   0x1ea0
+#define NV097_SET_TRANSFORM_CONSTANT_LOAD   0x1ea4
+
+#define NV097_NUM_TEXTURES                  4
+#define NV097_TEXTURE_MAX_SIZE              4096
+#define NV097_NUM_ATTRIBS                   16
+
+/* SET_SURFACE_FORMAT fields */
+#define NV097_SURFACE_COLOR_MASK            0x0000000f
+#define   NV097_SURFACE_COLOR_R5G6B5          0x3
+#define   NV097_SURFACE_COLOR_X8R8G8B8_Z8     0x4
+#define   NV097_SURFACE_COLOR_X8R8G8B8_O8     0x5
+#define   NV097_SURFACE_COLOR_A8R8G8B8        0x8
+#define   NV097_SURFACE_COLOR_B8              0x9
+#define   NV097_SURFACE_COLOR_G8B8            0xa
+#define NV097_SURFACE_ZETA_SHIFT            4
+#define   NV097_SURFACE_ZETA_Z16              0x1
+#define   NV097_SURFACE_ZETA_Z24S8            0x2
+#define NV097_SURFACE_TYPE_SHIFT            8
+#define   NV097_SURFACE_TYPE_SWIZZLE          0x2
+
+/* SET_TEXTURE_FORMAT fields */
+#define NV097_TEXTURE_FORMAT_DMA_B          (1 << 1)
+#define NV097_TEXTURE_FORMAT_CUBEMAP        (1 << 2)
+#define NV097_TEXTURE_FORMAT_DIMS_SHIFT     4
+#define NV097_TEXTURE_FORMAT_COLOR_SHIFT    8
+#define   NV097_TEXTURE_COLOR_SZ_Y8           0x00
+#define   NV097_TEXTURE_COLOR_SZ_AY8          0x01
+#define   NV097_TEXTURE_COLOR_SZ_A1R5G5B5     0x02
+#define   NV097_TEXTURE_COLOR_SZ_X1R5G5B5     0x03
+#define   NV097_TEXTURE_COLOR_SZ_A4R4G4B4     0x04
+#define   NV097_TEXTURE_COLOR_SZ_R5G6B5       0x05
+#define   NV097_TEXTURE_COLOR_SZ_A8R8G8B8     0x06
+#define   NV097_TEXTURE_COLOR_SZ_X8R8G8B8     0x07
+#define   NV097_TEXTURE_COLOR_LU_A1R5G5B5     0x10
+#define   NV097_TEXTURE_COLOR_LU_R5G6B5       0x11
+#define   NV097_TEXTURE_COLOR_LU_A8R8G8B8     0x12
+#define   NV097_TEXTURE_COLOR_LU_Y8           0x13
+#define   NV097_TEXTURE_COLOR_SZ_A8           0x19
+#define   NV097_TEXTURE_COLOR_LU_X1R5G5B5     0x1c
+#define   NV097_TEXTURE_COLOR_LU_A4R4G4B4     0x1d
+#define   NV097_TEXTURE_COLOR_LU_X8R8G8B8     0x1e
+#define   NV097_TEXTURE_COLOR_LU_DEPTH_X8_Y24 0x2e
+#define   NV097_TEXTURE_COLOR_LU_DEPTH_Y16    0x30
+#define NV097_TEXTURE_FORMAT_LEVELS_SHIFT   16
+#define NV097_TEXTURE_FORMAT_SIZE_U_SHIFT   20
+#define NV097_TEXTURE_FORMAT_SIZE_V_SHIFT   24
+#define NV097_TEXTURE_FORMAT_SIZE_P_SHIFT   28
+#define NV097_TEXTURE_CONTROL0_LOG_MAX_ANISO_SHIFT 4
+#define NV097_TEXTURE_CONTROL0_MAX_LOD_SHIFT 6
+#define NV097_TEXTURE_CONTROL0_MIN_LOD_SHIFT 18
+#define NV097_TEXTURE_CONTROL0_ENABLE       (1 << 30)
+#define NV097_TEXTURE_ADDRESS_U_SHIFT       0
+#define NV097_TEXTURE_ADDRESS_V_SHIFT       8
+#define NV097_TEXTURE_FILTER_LOD_BIAS_BITS  13
+#define NV097_TEXTURE_FILTER_MIN_SHIFT      16
+#define NV097_TEXTURE_FILTER_MAG_SHIFT      24
+
+/* CLEAR_REPORT_VALUE and GET_REPORT */
+#define NV097_REPORT_TYPE_ZPASS_PIXEL_CNT   1
+#define NV097_GET_REPORT_OFFSET_MASK        0x00ffffff
+#define NV097_GET_REPORT_TYPE_SHIFT         24
+
+/* SET_VERTEX_DATA_ARRAY_FORMAT fields */
+#define NV097_VERTEX_TYPE_MASK              0xf
+#define   NV097_VERTEX_TYPE_UB_D3D            0x0
+#define   NV097_VERTEX_TYPE_S1                0x1
+#define   NV097_VERTEX_TYPE_F                 0x2
+#define   NV097_VERTEX_TYPE_UB_OGL            0x4
+#define   NV097_VERTEX_TYPE_S32K              0x5
+#define   NV097_VERTEX_TYPE_CMP               0x6
+#define NV097_VERTEX_SIZE_SHIFT             4
+#define NV097_VERTEX_STRIDE_SHIFT           8
+#define NV097_VERTEX_OFFSET_DMA_B           (1u << 31)
+
+/* Comparison functions and cull faces use the GL enums */
+#define NV097_FUNC_NEVER                    0x0200
+#define NV097_CULL_FACE_FRONT               0x0404
+#define NV097_CULL_FACE_BACK                0x0405
+#define NV097_FRONT_FACE_CCW                0x0901
+#define NV097_SHADE_MODE_FLAT               0x1d00
+#define NV097_EXECUTION_MODE_PROGRAM        2
+#define NV097_CONTROL0_Z_PERSPECTIVE        (1 << 16)
+#define NV097_BEGIN_END_END                 0
+#define NV097_BEGIN_END_POINTS              1
+#define NV097_BEGIN_END_TRIANGLES           5
+#define NV097_BEGIN_END_TRIANGLE_STRIP      6
+#define NV097_BEGIN_END_TRIANGLE_FAN        7
+#define NV097_BEGIN_END_QUADS               8
+#define NV097_BEGIN_END_QUAD_STRIP          9
+#define NV097_BEGIN_END_POLYGON             10
+#define NV097_DRAW_ARRAYS_COUNT_SHIFT       24
+#define NV097_DRAW_ARRAYS_START_MASK        0x00ffffff
+#define NV097_CULL_FACE_FRONT_AND_BACK      0x0408
+#define NV097_COLOR_MATERIAL_DIFFUSE_SHIFT  4
+#define   NV097_COLOR_MATERIAL_FROM_DIFFUSE   1
+#define NV097_LIGHT_SIZE                    0x80
+#define NV097_LIGHT_AMBIENT_COLOR           0x00
+#define NV097_LIGHT_DIFFUSE_COLOR           0x0c
+#define NV097_LIGHT_SPECULAR_COLOR          0x18
+#define NV097_LIGHT_INFINITE_HALF_VECTOR    0x28
+#define NV097_LIGHT_INFINITE_DIRECTION      0x34
+
+#define NV039_METHODS(X) \
+    X(NV_NO_OPERATION,                      1,  nv_mthd_nop) \
+    X(NV_NOTIFY,                            1,  nv_mthd_notify) \
+    X(NV_WAIT_FOR_IDLE,                     1,  nv_mthd_nop) \
+    X(NV_SET_CONTEXT_DMA_NOTIFIES,          3,  nv_mthd_ctxdma) \
+    X(NV039_OFFSET_IN,                      7,  nv_mthd_store) \
+    X(NV039_BUFFER_NOTIFY,                  1,  nv039_buffer_notify)
+
+#define NV042_METHODS(X) \
+    X(NV_NO_OPERATION,                      1,  nv_mthd_nop) \
+    X(NV_NOTIFY,                            1,  nv_mthd_notify) \
+    X(NV_WAIT_FOR_IDLE,                     1,  nv_mthd_nop) \
+    X(NV_SET_CONTEXT_DMA_NOTIFIES,          3,  nv_mthd_ctxdma) \
+    X(NV042_SET_COLOR_FORMAT,               4,  nv_mthd_store)
+
+#define NV061_METHODS(X) \
+    X(NV_NO_OPERATION,                      1,  nv_mthd_nop) \
+    X(NV_NOTIFY,                            1,  nv_mthd_notify) \
+    X(NV_WAIT_FOR_IDLE,                     1,  nv_mthd_nop) \
+    X(NV_SET_CONTEXT_DMA_NOTIFIES,          1,  nv_mthd_ctxdma) \
+    X(NV061_SET_CONTEXT_COLOR_KEY,          7,  nv_mthd_store) \
+    X(NV061_SET_OPERATION,                  4,  nv_mthd_store) \
+    X(NV061_SIZE_IN,                        1,  nv061_size_in) \
+    X(NV061_COLOR,          NV061_COLOR_COUNT,  nv061_color)
+
+#define NV061_BULK(X) \
+    X(NV061_COLOR,          NV061_COLOR_COUNT,  nv061_color_bulk)
+
+#define NV097_METHODS(X) \
+    X(NV_NO_OPERATION,                      1,  nv_mthd_nop) \
+    X(NV_NOTIFY,                            1,  nv_mthd_notify) \
+    X(NV_WAIT_FOR_IDLE,                     1,  nv_mthd_nop) \
+    X(NV097_SET_FLIP_READ,                  5,  nv097_mthd_state) \
+    X(NV_SET_CONTEXT_DMA_NOTIFIES,          11, nv097_mthd_ctxdma) \
+    X(NV097_SET_SURFACE_CLIP_HORIZONTAL,    6,  nv097_mthd_state) \
+    X(NV097_SET_COMBINER_ALPHA_ICW,         19, nv097_mthd_state) \
+    X(NV097_SET_WINDOW_CLIP_TYPE,           1,  nv097_mthd_state) \
+    X(NV097_SET_WINDOW_CLIP_HORIZONTAL,     16, nv097_mthd_state) \
+    X(NV097_SET_ALPHA_TEST_ENABLE,          48, nv097_mthd_state) \
+    X(NV097_SET_TEXGEN_S,                   16, nv097_mthd_state) \
+    X(NV097_SET_TEXTURE_MATRIX_ENABLE,      4,  nv097_mthd_state) \
+    X(NV097_SET_POINT_SIZE,                 1,  nv097_mthd_state) \
+    X(NV097_SET_PROJECTION_MATRIX,          224, nv097_mthd_state) \
+    X(NV097_SET_TEXGEN_PLANE_S,             64, nv097_mthd_state) \
+    X(NV097_SET_FOG_PARAMS,                 3,  nv097_mthd_state) \
+    X(NV097_SET_FOG_PLANE,                  4,  nv097_mthd_state) \
+    X(NV097_SET_SCENE_AMBIENT_COLOR,        3,  nv097_mthd_state) \
+    X(NV097_SET_VIEWPORT_OFFSET,            120, nv097_mthd_state) \
+    X(NV097_SET_BACK_LIGHT,                 128, nv097_mthd_state) \
+    X(NV097_SET_LIGHT,                      256, nv097_mthd_state) \
+    X(NV097_SET_STIPPLE_CONTROL,            33, nv097_mthd_state) \
+    X(NV097_SET_VERTEX3F,                   128, nv097_mthd_state) \
+    X(NV097_SET_VERTEX_DATA_ARRAY_OFFSET,   32, nv097_mthd_state) \
+    X(NV097_SET_LOGIC_OP_ENABLE,            2,  nv097_mthd_state) \
+    X(NV097_CLEAR_REPORT_VALUE,             1,  nv097_clear_report_value) \
+    X(NV097_SET_ZPASS_PIXEL_COUNT_ENABLE,   1,  nv097_mthd_state) \
+    X(NV097_GET_REPORT,                     1,  nv097_get_report) \
+    X(NV097_SET_EYE_DIRECTION,              3,  nv097_mthd_state) \
+    X(NV097_SET_SHADER_CLIP_PLANE_MODE,     1,  nv097_mthd_state) \
+    X(NV097_SET_BEGIN_END,                  1,  nv097_set_begin_end) \
+    X(NV097_ARRAY_ELEMENT16,                1,  nv097_array_element16) \
+    X(NV097_ARRAY_ELEMENT32,                1,  nv097_array_element32) \
+    X(NV097_DRAW_ARRAYS,                    1,  nv097_draw_arrays) \
+    X(NV097_INLINE_ARRAY,                   1,  nv097_inline_array) \
+    X(NV097_SET_VERTEX_DATA2F_M,            160, nv097_mthd_state) \
+    X(NV097_SET_TEXTURE_OFFSET,             64, nv097_mthd_state) \
+    X(NV097_SET_SEMAPHORE_OFFSET,           1,  nv097_mthd_state) \
+    X(NV097_BACK_END_WRITE_SEMAPHORE_RELEASE, 1, nv097_semaphore_release) \
+    X(NV097_SET_ZMIN_MAX_CONTROL,           7,  nv097_mthd_state) \
+    X(NV097_SET_CLEAR_RECT_HORIZONTAL,      2,  nv097_mthd_state) \
+    X(NV097_SET_SPECULAR_FOG_FACTOR,        2,  nv097_mthd_state) \
+    X(NV097_SET_COMBINER_COLOR_OCW,         9,  nv097_mthd_state) \
+    X(NV097_SET_SHADOW_ZSLOPE_THRESHOLD,    5,  nv097_mthd_state) \
+    X(NV097_SET_TRANSFORM_EXECUTION_MODE,   5,  nv097_mthd_state)
+
+/*
+ * Kelvin state groups.  A method only marks its group dirty when it
+ * changes a value; derived state of dirty groups is rebuilt at the next
+ * draw.  X(method, count, groups)
+ */
+#define NV097_DIRTY_SURFACE             (1 << 0)
+#define NV097_DIRTY_BLEND               (1 << 1)
+#define NV097_DIRTY_DEPTH               (1 << 2)
+#define NV097_DIRTY_RASTER              (1 << 3)
+#define NV097_DIRTY_TRANSFORM           (1 << 4)
+#define NV097_DIRTY_VERTEX              (1 << 5)
+#define NV097_DIRTY_TEXTURE0            (1 << 6)
+#define NV097_DIRTY_TEXTURES            (0xf << 6)
+#define NV097_DIRTY_LIGHTING            (1 << 10)
+#define NV097_DIRTY_ALL                 ((1 << 11) - 1)
+
+#define NV097_STATE_GROUPS(X) \
+    X(NV097_SET_CONTEXT_DMA_A,              2,  NV097_DIRTY_TEXTURES) \
+    X(NV097_SET_CONTEXT_DMA_COLOR,          2,  NV097_DIRTY_SURFACE) \
+    X(NV097_SET_CONTEXT_DMA_VERTEX_A,       2,  NV097_DIRTY_VERTEX) \
+    X(NV097_SET_SURFACE_CLIP_HORIZONTAL,    6,  NV097_DIRTY_SURFACE) \
+    X(NV097_SET_CONTROL0,                   1,  NV097_DIRTY_RASTER) \
+    X(NV097_SET_LIGHT_CONTROL,              2,  NV097_DIRTY_LIGHTING) \
+    X(NV097_SET_WINDOW_CLIP_TYPE,           1,  NV097_DIRTY_SURFACE) \
+    X(NV097_SET_WINDOW_CLIP_HORIZONTAL,     16, NV097_DIRTY_SURFACE) \
+    X(NV097_SET_ALPHA_TEST_ENABLE,          2,  NV097_DIRTY_BLEND) \
+    X(NV097_SET_CULL_FACE_ENABLE,           1,  NV097_DIRTY_RASTER) \
+    X(NV097_SET_DEPTH_TEST_ENABLE,          1,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_DITHER_ENABLE,              1,  NV097_DIRTY_BLEND) \
+    X(NV097_SET_LIGHTING_ENABLE,            1,  NV097_DIRTY_LIGHTING) \
+    X(NV097_SET_STENCIL_TEST_ENABLE,        1,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_ALPHA_FUNC,                 6,  NV097_DIRTY_BLEND) \
+    X(NV097_SET_DEPTH_FUNC,                 1,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_COLOR_MASK,                 1,  NV097_DIRTY_BLEND) \
+    X(NV097_SET_DEPTH_MASK,                 8,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_SHADE_MODE,                 1,  NV097_DIRTY_RASTER) \
+    X(NV097_SET_FRONT_POLYGON_MODE,         2,  NV097_DIRTY_RASTER) \
+    X(NV097_SET_CLIP_MIN,                   2,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_CULL_FACE,                  2,  NV097_DIRTY_RASTER) \
+    X(NV097_SET_NORMALIZATION_ENABLE,       7,  NV097_DIRTY_LIGHTING) \
+    X(NV097_SET_TEXGEN_S,                   16, NV097_DIRTY_TRANSFORM) \
+    X(NV097_SET_TEXTURE_MATRIX_ENABLE,      4,  NV097_DIRTY_TRANSFORM) \
+    X(NV097_SET_POINT_SIZE,                 1,  NV097_DIRTY_RASTER) \
+    X(NV097_SET_PROJECTION_MATRIX,          224, NV097_DIRTY_TRANSFORM) \
+    X(NV097_SET_TEXGEN_PLANE_S,             64, NV097_DIRTY_TRANSFORM) \
+    X(NV097_SET_SCENE_AMBIENT_COLOR,        3,  NV097_DIRTY_LIGHTING) \
+    X(NV097_SET_VIEWPORT_OFFSET,            4,  NV097_DIRTY_TRANSFORM) \
+    X(NV097_SET_VIEWPORT_SCALE,             4,  NV097_DIRTY_TRANSFORM) \
+    X(NV097_SET_LIGHT,                      256, NV097_DIRTY_LIGHTING) \
+    X(NV097_SET_VERTEX_DATA_ARRAY_OFFSET,   32, NV097_DIRTY_VERTEX) \
+    X(NV097_SET_LOGIC_OP_ENABLE,            2,  NV097_DIRTY_BLEND) \
+    X(NV097_SET_TEXTURE_OFFSET,             16, NV097_DIRTY_TEXTURE0 << 0) \
+    X(NV097_SET_TEXTURE_OFFSET + 0x40,      16, NV097_DIRTY_TEXTURE0 << 1) \
+    X(NV097_SET_TEXTURE_OFFSET + 0x80,      16, NV097_DIRTY_TEXTURE0 << 2) \
+    X(NV097_SET_TEXTURE_OFFSET + 0xc0,      16, NV097_DIRTY_TEXTURE0 << 3) \
+    X(NV097_SET_ZMIN_MAX_CONTROL,           1,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_SHADOW_DEPTH_FUNC,          1,  NV097_DIRTY_DEPTH) \
+    X(NV097_SET_TRANSFORM_EXECUTION_MODE,   1,  NV097_DIRTY_TRANSFORM)
+
+#define NV097_BULK(X) \
+    X(NV097_INLINE_ARRAY,                   1,  nv097_inline_array_bulk)
+
+#define NV_NO_BULK(X)
+
+/* X(class, context state, method list, bulk method list) */
+#define NV_CLASSES(X) \
+    X(NV03_MEMORY_TO_MEMORY_FORMAT, m2mf,   NV039_METHODS, NV_NO_BULK) \
+    X(NV04_CONTEXT_SURFACES_2D,     surf2d, NV042_METHODS, NV_NO_BULK) \
+    X(NV10_CONTEXT_SURFACES_2D,     surf2d, NV042_METHODS, NV_NO_BULK) \
+    X(NV04_IMAGE_FROM_CPU,          ifc,    NV061_METHODS, NV061_BULK) \
+    X(NV20_KELVIN_PRIMITIVE,        kelvin, NV097_METHODS, NV097_BULK)
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * NVIDIA GeForce3 render worker pool
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/processor.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "geforce3_pool.h"
+
+/* Stride scheduling: a client's pass advances by cost / weight */
+#define NV_STRIDE_ONE           (1 << 16)
+
+/*
+ * A worker that runs out of jobs spins this long for more if the last job
+ * was submitted less than NV_SPIN_WINDOW_NS ago, and sleeps otherwise.
+ */
+#define NV_SPIN_WINDOW_NS       (100 * SCALE_US)
+#define NV_SPIN_NS              (20 * SCALE_US)
+
+struct NVRenderClient {
+    unsigned weight;
+    uint64_t pass;
+    QSIMPLEQ_HEAD(, NVRenderJob) jobs;
+    QTAILQ_ENTRY(NVRenderClient) next;
+};
+
+typedef struct NVRenderPool {
+    QemuMutex lock;
+    QemuCond cond;
+    bool stop;
+
+    /*
+     * Configuration as requested, 0 threads meaning one per usable host
+     * CPU.  Fixed while the pool is in use; the first device configuring
+     * an idle pool decides.
+     */
+    bool configured;
+    unsigned nthreads;
+    unsigned long *affinity;
+    unsigned long affinity_bits;
+
+    QemuThread *threads;
+    unsigned running;
+
+    /* Jobs waiting, workers asleep on the condition, last submission */
+    unsigned queued;
+    unsigned sleeping;
+    int64_t last_submit;
+
+    /* Pass of the last dispatched job; clients waking up start here */
+    uint64_t pass;
+    QTAILQ_HEAD(, NVRenderClient) clients;
+} NVRenderPool;
+
+static NVRenderPool nv_pool;
+
+static void __attribute__((__constructor__)) nv_render_pool_init(void)
+{
+    qemu_mutex_init(&nv_pool.lock);
+    qemu_cond_init(&nv_pool.cond);
+    QTAILQ_INIT(&nv_pool.clients);
+}
+
+static bool nv_parse_cpu_range(const char *str, unsigned long *first,
+                               unsigned long *last, Error **errp)
+{
+    const char *end;
+
+    if (qemu_strtoul(str, &end, 10, first) < 0) {
+        goto fail;
+    }
+    *last = *first;
+    if (*end == '-' && qemu_strtoul(end + 1, &end, 10, last) < 0) {
+        goto fail;
+    }
+    if (*end || *last < *first) {
+        goto fail;
+    }
+    return true;
+
+fail:
+    error_setg(errp, "geforce3: invalid host CPU range '%s'", str);
+    return false;
+}
+
+static unsigned long *nv_parse_cpu_list(const char *list, unsigned long *nbits,
+                                        Error **errp)
+{
+    g_auto(GStrv) ranges = g_strsplit(list, ",", -1);
+    unsigned long first, last, max = 0;
+    unsigned long *map;
+    int i;
+
+    for (i = 0; ranges[i]; i++) {
+        if (!nv_parse_cpu_range(ranges[i], &first, &last, errp)) {
+            return NULL;
+        }
+        max = MAX(max, last + 1);
+    }
+    if (!max) {
+        error_setg(errp, "geforce3: empty host CPU list");
+        return NULL;
+    }
+
+    map = bitmap_new(max);
+    for (i = 0; ranges[i]; i++) {
+        nv_parse_cpu_range(ranges[i], &first, &last, &error_abort);
+        bitmap_set(map, first, last - first + 1);
+    }
+    *nbits = max;
+    return map;
+}
+
+bool nv_render_pool_configure(unsigned threads, const char *affinity,
+                              Error **errp)
+{
+    unsigned long *map = NULL;
+    unsigned long nbits = 0;
+
+    if (affinity) {
+        map = nv_parse_cpu_list(affinity, &nbits, errp);
+        if (!map) {
+            return false;
+        }
+    }
+
+    QEMU_LOCK_GUARD(&nv_pool.lock);
+
+    if (nv_pool.configured) {
+        if (threads != nv_pool.nthreads ||
+            nbits != nv_pool.affinity_bits ||
+            (map && !bitmap_equal(map, nv_pool.affinity, nbits))) {
+            warn_report("geforce3: render pool already configured, "
+                        "ignoring render-threads/render-affinity");
+        }
+        g_free(map);
+        return true;
+    }
+
+    g_free(nv_pool.affinity);
+    nv_pool.configured = true;
+    nv_pool.nthreads = threads;
+    nv_pool.affinity = map;
+    nv_pool.affinity_bits = nbits;
+    return true;
+}
+
+/* Called with the pool lock held */
+static NVRenderJob *nv_render_pick(void)
+{
+    NVRenderClient *c, *best = NULL;
+    NVRenderJob *job;
+
+    QTAILQ_FOREACH(c, &nv_pool.clients, next) {
+        if (!QSIMPLEQ_EMPTY(&c->jobs) && (!best || c->pass < best->pass)) {
+            best = c;
+        }
+    }
+    if (!best) {
+        return NULL;
+    }
+
+    job = QSIMPLEQ_FIRST(&best->jobs);
+    QSIMPLEQ_REMOVE_HEAD(&best->jobs, next);
+    qatomic_dec(&nv_pool.queued);
+    nv_pool.pass = best->pass;
+    best->pass += (uint64_t)MAX(job->cost, 1) * NV_STRIDE_ONE / best->weight;
+    return job;
+}
+
+/* Called with the pool lock held */
+static void nv_render_job_done(NVRenderJob *job)
+{
+    NVRenderBatch *b = job->batch;
+
+    if (--b->pending == 0) {
+        qemu_event_set(&b->done);
+    }
+}
+
+/*
+ * Called with the pool lock held, drops it while spinning.  Returns true
+ * if jobs or a stop request showed up, false if the worker should sleep.
+ * Idle devices submitted long ago, so an idle pool never spins.
+ */
+static bool nv_render_spin(void)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t end = now + NV_SPIN_NS;
+
+    if (now - nv_pool.last_submit >= NV_SPIN_WINDOW_NS) {
+        return false;
+    }
+
+    qemu_mutex_unlock(&nv_pool.lock);
+    do {
+        if (qatomic_read(&nv_pool.queued) || qatomic_read(&nv_pool.stop)) {
+            break;
+        }
+        cpu_relax();
+    } while (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end);
+    qemu_mutex_lock(&nv_pool.lock);
+
+    /*
+     * A job submitted between the last check and the lock saw nobody
+     * sleeping and didn't signal: look again before going to sleep
+     */
+    return nv_pool.queued || nv_pool.stop;
+}
+
+static void *nv_render_thread(void *opaque)
+{
+    NVRenderJob *job;
+
+    qemu_mutex_lock(&nv_pool.lock);
+    while (!nv_pool.stop) {
+        job = nv_render_pick();
+        if (!job) {
+            if (!nv_render_spin()) {
+                nv_pool.sleeping++;
+                qemu_cond_wait(&nv_pool.cond, &nv_pool.lock);
+                nv_pool.sleeping--;
+            }
+            continue;
+        }
+
+        qemu_mutex_unlock(&nv_pool.lock);
+        job->fn(job->opaque);
+        qemu_mutex_lock(&nv_pool.lock);
+        nv_render_job_done(job);
+    }
+    qemu_mutex_unlock(&nv_pool.lock);
+    return NULL;
+}
+
+/* Called with the pool lock held */
+static void nv_render_pool_start(void)
+{
+    unsigned i, n = nv_pool.nthreads;
+    int ret;
+
+    if (!n) {
+        n = nv_pool.affinity ?
+            bitmap_count_one(nv_pool.affinity, nv_pool.affinity_bits) :
+            g_get_num_processors();
+    }
+
+    nv_pool.stop = false;
+    nv_pool.running = n;
+    nv_pool.threads = g_new0(QemuThread, nv_pool.running);
+    for (i = 0; i < nv_pool.running; i++) {
+        g_autofree char *name = g_strdup_printf("geforce3-render/%u", i);
+
+        qemu_thread_create(&nv_pool.threads[i], name, nv_render_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+        if (nv_pool.affinity) {
+            ret = qemu_thread_set_affinity(&nv_pool.threads[i],
+                                           nv_pool.affinity,
+                                           nv_pool.affinity_bits);
+            if (ret) {
+                warn_report("geforce3: cannot set render thread affinity: %s",
+                            strerror(-ret));
+            }
+        }
+    }
+}
+
+/* Called with the pool lock held; drops it while joining */
+static void nv_render_pool_stop(void)
+{
+    QemuThread *threads = nv_pool.threads;
+    unsigned i, n = nv_pool.running;
+
+    qatomic_set(&nv_pool.stop, true);
+    nv_pool.threads = NULL;
+    nv_pool.running = 0;
+
+    /* The next device may configure the pool again */
+    nv_pool.configured = false;
+    qemu_cond_broadcast(&nv_pool.cond);
+
+    qemu_mutex_unlock(&nv_pool.lock);
+    for (i = 0; i < n; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+    qemu_mutex_lock(&nv_pool.lock);
+}
+
+NVRenderClient *nv_render_client_new(unsigned weight)
+{
+    NVRenderClient *c = g_new0(NVRenderClient, 1);
+
+    c->weight = MAX(weight, 1);
+    QSIMPLEQ_INIT(&c->jobs);
+
+    QEMU_LOCK_GUARD(&nv_pool.lock);
+
+    if (QTAILQ_EMPTY(&nv_pool.clients) && !nv_pool.running) {
+        nv_render_pool_start();
+    }
+    c->pass = nv_pool.pass;
+    QTAILQ_INSERT_TAIL(&nv_pool.clients, c, next);
+    return c;
+}
+
+void nv_render_client_free(NVRenderClient *c)
+{
+    if (!c) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&nv_pool.lock);
+
+    /* Batches are always waited for, so the queue is empty here */
+    assert(QSIMPLEQ_EMPTY(&c->jobs));
+    QTAILQ_REMOVE(&nv_pool.clients, c, next);
+    g_free(c);
+
+    /* Give the threads back when the last device goes away */
+    if (QTAILQ_EMPTY(&nv_pool.clients) && nv_pool.running) {
+        nv_render_pool_stop();
+    }
+}
+
+void nv_render_batch_init(NVRenderBatch *b, NVRenderClient *c)
+{
+    b->client = c;
+    b->pending = 0;
+    qemu_event_init(&b->done, true);
+}
+
+void nv_render_batch_destroy(NVRenderBatch *b)
+{
+    qemu_event_destroy(&b->done);
+}
+
+void nv_render_submit(NVRenderBatch *b, NVRenderJob *job)
+{
+    NVRenderClient *c = b->client;
+
+    job->batch = b;
+
+    QEMU_LOCK_GUARD(&nv_pool.lock);
+
+    if (b->pending++ == 0) {
+        qemu_event_reset(&b->done);
+    }
+    if (QSIMPLEQ_EMPTY(&c->jobs)) {
+        /* Idle clients don't bank credit while they had nothing to run */
+        c->pass = MAX(c->pass, nv_pool.pass);
+    }
+    QSIMPLEQ_INSERT_TAIL(&c->jobs, job, next);
+    qatomic_inc(&nv_pool.queued);
+    nv_pool.last_submit = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    /* Spinning workers pick the job up without a wake up */
+    if (nv_pool.sleeping) {
+        qemu_cond_signal(&nv_pool.cond);
+    }
+}
+
+void nv_render_batch_wait(NVRenderBatch *b)
+{
+    NVRenderClient *c = b->client;
+    NVRenderJob *job;
+
+    qemu_mutex_lock(&nv_pool.lock);
+    while (b->pending) {
+        job = QSIMPLEQ_FIRST(&c->jobs);
+        if (!job) {
+            qemu_mutex_unlock(&nv_pool.lock);
+            qemu_event_wait(&b->done);
+            qemu_mutex_lock(&nv_pool.lock);
+            continue;
+        }
+
+        QSIMPLEQ_REMOVE_HEAD(&c->jobs, next);
+        qatomic_dec(&nv_pool.queued);
+        qemu_mutex_unlock(&nv_pool.lock);
+        job->fn(job->opaque);
+        qemu_mutex_lock(&nv_pool.lock);
+        nv_render_job_done(job);
+    }
+    qemu_mutex_unlock(&nv_pool.lock);
+}
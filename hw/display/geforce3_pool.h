@@ -0,0 +1,59 @@
+/*
+ * NVIDIA GeForce3 render worker pool
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GEFORCE3_POOL_H
+#define GEFORCE3_POOL_H
+
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+
+/*
+ * One pool of render threads serves every GeForce3 in the process.  Each
+ * submitter (a device, or a channel within it) is a client with a weight;
+ * clients are served in proportion to their weight, so a busy VM cannot
+ * starve the others.
+ */
+typedef struct NVRenderClient NVRenderClient;
+
+typedef struct NVRenderBatch {
+    NVRenderClient *client;
+    unsigned pending;
+    QemuEvent done;
+} NVRenderBatch;
+
+/* Owned by the submitter and must stay valid until the batch completes */
+typedef struct NVRenderJob {
+    void (*fn)(void *opaque);
+    void *opaque;
+    unsigned cost;              /* relative work, e.g. pixels touched */
+    NVRenderBatch *batch;
+    QSIMPLEQ_ENTRY(NVRenderJob) next;
+} NVRenderJob;
+
+/*
+ * Pool size (0 for one thread per usable host CPU) and host CPU list
+ * ("0-7,16") the threads are pinned to.  The first device to create a
+ * client decides; later conflicting settings are ignored with a warning.
+ */
+bool nv_render_pool_configure(unsigned threads, const char *affinity,
+                              Error **errp);
+
+NVRenderClient *nv_render_client_new(unsigned weight);
+void nv_render_client_free(NVRenderClient *c);
+
+void nv_render_batch_init(NVRenderBatch *b, NVRenderClient *c);
+void nv_render_batch_destroy(NVRenderBatch *b);
+void nv_render_submit(NVRenderBatch *b, NVRenderJob *job);
+
+/* Runs queued jobs of the batch's client on the caller while waiting */
+void nv_render_batch_wait(NVRenderBatch *b);
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * NVIDIA GeForce3 triangle setup and rasterization
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "geforce3_engine.h"
+
+/* Blend factors and equations, GL enums */
+#define NV_BLEND_ZERO                       0x0000
+#define NV_BLEND_ONE                        0x0001
+#define NV_BLEND_SRC_COLOR                  0x0300
+#define NV_BLEND_ONE_MINUS_SRC_COLOR        0x0301
+#define NV_BLEND_SRC_ALPHA                  0x0302
+#define NV_BLEND_ONE_MINUS_SRC_ALPHA        0x0303
+#define NV_BLEND_DST_ALPHA                  0x0304
+#define NV_BLEND_ONE_MINUS_DST_ALPHA        0x0305
+#define NV_BLEND_DST_COLOR                  0x0306
+#define NV_BLEND_ONE_MINUS_DST_COLOR        0x0307
+#define NV_BLEND_SRC_ALPHA_SATURATE         0x0308
+#define NV_BLEND_CONSTANT_COLOR             0x8001
+#define NV_BLEND_ONE_MINUS_CONSTANT_COLOR   0x8002
+#define NV_BLEND_CONSTANT_ALPHA             0x8003
+#define NV_BLEND_ONE_MINUS_CONSTANT_ALPHA   0x8004
+#define NV_BLEND_EQUATION_MIN               0x8007
+#define NV_BLEND_EQUATION_MAX               0x8008
+#define NV_BLEND_EQUATION_SUBTRACT          0x800a
+#define NV_BLEND_EQUATION_REVERSE_SUBTRACT  0x800b
+
+/* Bounds and barycentric planes of a triangle that passed the rejection */
+static bool nv_triangle_planes(NVTriangle *t, const NVVertex *v[3],
+                               const NVRenderTarget *rt)
+{
+    float area, a, b;
+    int i;
+
+    /* Clamp while still in float, huge coordinates don't fit an int */
+    t->x0 = MAX(floorf(MIN(MIN(v[0]->x, v[1]->x), v[2]->x)), rt->x0);
+    t->y0 = MAX(floorf(MIN(MIN(v[0]->y, v[1]->y), v[2]->y)), rt->y0);
+    t->x1 = MIN(ceilf(MAX(MAX(v[0]->x, v[1]->x), v[2]->x)) + 1, rt->x1);
+    t->y1 = MIN(ceilf(MAX(MAX(v[0]->y, v[1]->y), v[2]->y)) + 1, rt->y1);
+    if (t->x0 >= t->x1 || t->y0 >= t->y1) {
+        return false;
+    }
+
+    /* Edge opposite each vertex, scaled to be 1 at that vertex */
+    for (i = 0; i < 3; i++) {
+        const NVVertex *va = v[(i + 1) % 3], *vb = v[(i + 2) % 3];
+
+        a = va->y - vb->y;
+        b = vb->x - va->x;
+        t->bary[i][0] = a;
+        t->bary[i][1] = b;
+        t->bary[i][2] = -a * va->x - b * va->y;
+        area = a * v[i]->x + b * v[i]->y + t->bary[i][2];
+        t->bary[i][0] /= area;
+        t->bary[i][1] /= area;
+        t->bary[i][2] /= area;
+        t->v[i] = *v[i];
+    }
+    return true;
+}
+
+unsigned nv_setup_triangles(NVTriangle *out, const NVVertex *v,
+                            const uint32_t (*prim)[3], unsigned n,
+                            const NVRenderTarget *rt, const NVRasterOps *ops)
+{
+    const NVVertex *p[NV_ENGINE_BATCH][3];
+    NVVecF x[3], y[3], iw[3], area, lo, hi, zero = { };
+    NVVecI live, front;
+    unsigned base, m, count = 0;
+    int j, k;
+
+    for (base = 0; base < n; base += NV_ENGINE_BATCH) {
+        m = MIN(n - base, NV_ENGINE_BATCH);
+        for (k = 0; k < NV_ENGINE_BATCH; k++) {
+            for (j = 0; j < 3; j++) {
+                /* Padding lanes repeat a vertex and come out degenerate */
+                p[k][j] = &v[prim[base + MIN(k, m - 1)][k < m ? j : 0]];
+                x[j][k] = p[k][j]->x;
+                y[j][k] = p[k][j]->y;
+                iw[j][k] = p[k][j]->iw;
+            }
+        }
+
+        /* No near plane clipping: anything reaching behind the eye goes */
+        live = (iw[0] != zero) & (iw[1] != zero) & (iw[2] != zero);
+
+        /*
+         * Window y grows downwards, so counter-clockwise has negative
+         * area.  Degenerate and NaN triangles go here too.
+         */
+        area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        live &= (area != zero) & (area == area);
+        front = ops->front_ccw ? area < zero : area > zero;
+        if (ops->cull_front) {
+            live &= ~front;
+        }
+        if (ops->cull_back) {
+            live &= front;
+        }
+
+        /* Bounding box against the target */
+        lo = nv_vmin(nv_vmin(x[0], x[1]), x[2]);
+        hi = nv_vmax(nv_vmax(x[0], x[1]), x[2]);
+        live &= (lo < (float)rt->x1) & (hi > (float)(rt->x0 - 1));
+        lo = nv_vmin(nv_vmin(y[0], y[1]), y[2]);
+        hi = nv_vmax(nv_vmax(y[0], y[1]), y[2]);
+        live &= (lo < (float)rt->y1) & (hi > (float)(rt->y0 - 1));
+
+        for (k = 0; k < m; k++) {
+            if (live[k]) {
+                count += nv_triangle_planes(&out[count], p[k], rt);
+            }
+        }
+    }
+    return count;
+}
+
+static inline bool nv_compare(unsigned func, float a, float b)
+{
+    switch (func) {
+    case NV_FUNC_NEVER:
+        return false;
+    case NV_FUNC_LESS:
+        return a < b;
+    case NV_FUNC_EQUAL:
+        return a == b;
+    case NV_FUNC_LEQUAL:
+        return a <= b;
+    case NV_FUNC_GREATER:
+        return a > b;
+    case NV_FUNC_NOTEQUAL:
+        return a != b;
+    case NV_FUNC_GEQUAL:
+        return a >= b;
+    default:
+        return true;
+    }
+}
+
+/* Pixels on an edge belong to the triangle whose edge is top or left */
+static inline bool nv_inside(const float *plane, float l)
+{
+    return l > 0 || (l == 0 && (plane[0] > 0 ||
+                                (plane[0] == 0 && plane[1] > 0)));
+}
+
+static void nv_load_color(const NVRenderTarget *rt, const uint8_t *p,
+                          float c[4])
+{
+    uint32_t v;
+
+    if (rt->color_bpp == 2) {
+        v = lduw_le_p(p);
+        c[0] = ((v >> 11) & 0x1f) / 31.0f;
+        c[1] = ((v >> 5) & 0x3f) / 63.0f;
+        c[2] = (v & 0x1f) / 31.0f;
+        c[3] = 1;
+    } else {
+        v = ldl_le_p(p);
+        c[0] = ((v >> 16) & 0xff) / 255.0f;
+        c[1] = ((v >> 8) & 0xff) / 255.0f;
+        c[2] = (v & 0xff) / 255.0f;
+        c[3] = (v >> 24) / 255.0f;
+    }
+}
+
+static void nv_store_color(const NVRenderTarget *rt, const NVRasterOps *ops,
+                           uint8_t *p, const float c[4])
+{
+    uint32_t v, old, mask = ops->write_mask;
+
+    v = (uint32_t)(c[3] * 255 + 0.5f) << 24 |
+        (uint32_t)(c[0] * 255 + 0.5f) << 16 |
+        (uint32_t)(c[1] * 255 + 0.5f) << 8 |
+        (uint32_t)(c[2] * 255 + 0.5f);
+    if (rt->color_bpp == 2) {
+        v = ((v >> 8) & 0xf800) | ((v >> 5) & 0x07e0) | ((v >> 3) & 0x001f);
+        mask = ((mask >> 8) & 0xf800) | ((mask >> 5) & 0x07e0) |
+               ((mask >> 3) & 0x001f);
+        old = lduw_le_p(p);
+        stw_le_p(p, (old & ~mask) | (v & mask));
+    } else {
+        old = ldl_le_p(p);
+        stl_le_p(p, (old & ~mask) | (v & mask));
+    }
+}
+
+static float nv_blend_factor(uint32_t factor, const float src[4],
+                             const float dst[4], const float constant[4],
+                             int i)
+{
+    switch (factor) {
+    case NV_BLEND_ZERO:
+        return 0;
+    case NV_BLEND_ONE:
+        return 1;
+    case NV_BLEND_SRC_COLOR:
+        return src[i];
+    case NV_BLEND_ONE_MINUS_SRC_COLOR:
+        return 1 - src[i];
+    case NV_BLEND_SRC_ALPHA:
+        return src[3];
+    case NV_BLEND_ONE_MINUS_SRC_ALPHA:
+        return 1 - src[3];
+    case NV_BLEND_DST_ALPHA:
+        return dst[3];
+    case NV_BLEND_ONE_MINUS_DST_ALPHA:
+        return 1 - dst[3];
+    case NV_BLEND_DST_COLOR:
+        return dst[i];
+    case NV_BLEND_ONE_MINUS_DST_COLOR:
+        return 1 - dst[i];
+    case NV_BLEND_SRC_ALPHA_SATURATE:
+        return i == 3 ? 1 : MIN(src[3], 1 - dst[3]);
+    case NV_BLEND_CONSTANT_COLOR:
+        return constant[i];
+    case NV_BLEND_ONE_MINUS_CONSTANT_COLOR:
+        return 1 - constant[i];
+    case NV_BLEND_CONSTANT_ALPHA:
+        return constant[3];
+    case NV_BLEND_ONE_MINUS_CONSTANT_ALPHA:
+        return 1 - constant[3];
+    default:
+        return 1;
+    }
+}
+
+static void nv_blend(const NVRasterOps *ops, float c[4], const float dst[4])
+{
+    float s, d;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        s = c[i] * nv_blend_factor(ops->sfactor, c, dst, ops->blend_color, i);
+        d = dst[i] * nv_blend_factor(ops->dfactor, c, dst, ops->blend_color,
+                                     i);
+        switch (ops->equation) {
+        case NV_BLEND_EQUATION_MIN:
+            s = MIN(c[i], dst[i]);
+            break;
+        case NV_BLEND_EQUATION_MAX:
+            s = MAX(c[i], dst[i]);
+            break;
+        case NV_BLEND_EQUATION_SUBTRACT:
+            s = s - d;
+            break;
+        case NV_BLEND_EQUATION_REVERSE_SUBTRACT:
+            s = d - s;
+            break;
+        default:
+            s = s + d;
+            break;
+        }
+        c[i] = s;
+    }
+}
+
+/* Fragment depth in buffer units */
+static inline uint32_t nv_depth_value(const NVRasterOps *ops, float z)
+{
+    return (uint32_t)MIN(MAX(z, ops->depth_min), ops->depth_max);
+}
+
+/* Depth test, without updating; false if the fragment is rejected */
+static inline bool nv_depth_test(const NVRenderTarget *rt,
+                                 const NVRasterOps *ops, const uint8_t *zp,
+                                 uint32_t depth)
+{
+    uint32_t stored;
+
+    if (!ops->depth_test) {
+        return true;
+    }
+    if (rt->zeta_bpp == 2) {
+        stored = lduw_le_p(zp);
+    } else {
+        stored = ldl_le_p(zp) >> 8;
+    }
+    return nv_compare(ops->depth_func, depth, stored);
+}
+
+static inline void nv_depth_write(const NVRenderTarget *rt,
+                                  const NVRasterOps *ops, uint8_t *zp,
+                                  uint32_t depth)
+{
+    if (!ops->depth_write) {
+        return;
+    }
+    if (rt->zeta_bpp == 2) {
+        stw_le_p(zp, depth);
+    } else {
+        stl_le_p(zp, (depth << 8) | (ldl_le_p(zp) & 0xff));
+    }
+}
+
+/* Quad lane offsets from the pixel corner to the pixel centres */
+static const NVVecF nv_quad_x = { 0.5f, 1.5f, 0.5f, 1.5f };
+static const NVVecF nv_quad_y = { 0.5f, 0.5f, 1.5f, 1.5f };
+
+/*
+ * Fragment colors of @n 2x2 quads at barycentric weights @l, two quads at
+ * most so wide hosts can sample them together.  There are no register
+ * combiners yet: textures modulate the diffuse color and the specular
+ * color is added on top.
+ */
+static void nv_shade_quads(const NVRasterOps *ops, const NVTriangle *t,
+                           const NVVecF l[][3], NVVecF c[][4], unsigned n)
+{
+    const NVVertex *v = t->v;
+    NVVecF w[2][3], iw, spec[2][3], tc[2][3], tq, texel[2][4], zero = { };
+    unsigned q;
+    int i, j;
+
+    for (q = 0; q < n; q++) {
+        /* Perspective correct weights */
+        iw = l[q][0] * v[0].iw + l[q][1] * v[1].iw + l[q][2] * v[2].iw;
+        for (i = 0; i < 3; i++) {
+            w[q][i] = l[q][i] * v[i].iw / iw;
+        }
+
+        for (j = 0; j < 4; j++) {
+            c[q][j] = ops->flat ? zero + v[2].color[j] :
+                      w[q][0] * v[0].color[j] + w[q][1] * v[1].color[j] +
+                      w[q][2] * v[2].color[j];
+        }
+        for (j = 0; j < 3; j++) {
+            spec[q][j] = ops->flat ? zero + v[2].spec[j] :
+                         w[q][0] * v[0].spec[j] + w[q][1] * v[1].spec[j] +
+                         w[q][2] * v[2].spec[j];
+        }
+    }
+
+    for (i = 0; i < NV_ENGINE_TEXTURES; i++) {
+        if (!ops->tex[i].texels) {
+            continue;
+        }
+        for (q = 0; q < n; q++) {
+            tq = w[q][0] * v[0].tex[i][3] + w[q][1] * v[1].tex[i][3] +
+                 w[q][2] * v[2].tex[i][3];
+            for (j = 0; j < 3; j++) {
+                tc[q][j] = w[q][0] * v[0].tex[i][j] +
+                           w[q][1] * v[1].tex[i][j] +
+                           w[q][2] * v[2].tex[i][j];
+                tc[q][j] = nv_vsel(tq != zero, tc[q][j] / tq, tc[q][j]);
+            }
+        }
+        if (n == 2) {
+            nv_sample_pair(&ops->tex[i], (const NVVecF (*)[3])tc, texel);
+        } else {
+            nv_sample_quad(&ops->tex[i], tc[0], texel[0]);
+        }
+        for (q = 0; q < n; q++) {
+            for (j = 0; j < 4; j++) {
+                c[q][j] *= texel[q][j];
+            }
+        }
+    }
+
+    for (q = 0; q < n; q++) {
+        for (j = 0; j < 3; j++) {
+            c[q][j] += spec[q][j];
+        }
+        for (j = 0; j < 4; j++) {
+            c[q][j] = nv_vclamp(c[q][j], 0, 1);
+        }
+    }
+}
+
+/*
+ * Walk the box in aligned 4x2 blocks, two 2x2 quads side by side, so
+ * texturing sees pixel neighbours.  Lanes outside the box or the
+ * triangle, or failing the depth test, are shaded but not written; quads
+ * without any such lane are skipped.  Depth is only written for fragments
+ * that also pass the alpha test.
+ */
+static unsigned nv_raster_triangle(const NVRenderTarget *rt,
+                                   const NVRasterOps *ops, const NVTriangle *t,
+                                   int x0, int y0, int x1, int y1)
+{
+    unsigned passed = 0;
+    const NVVertex *v = t->v;
+    NVVecF l[2][3], px, py, c[2][4];
+    float frag[4], dst[4];
+    bool live[2][NV_ENGINE_BATCH], any;
+    uint32_t depth[2][NV_ENGINE_BATCH];
+    uint8_t *cp, *zp[2][NV_ENGINE_BATCH];
+    int x, y, qx[2], fx, fy, n, q, i, j, k;
+
+    for (y = y0 & ~1; y < y1; y += 2) {
+        for (x = x0 & ~1; x < x1; x += 4) {
+            n = 0;
+            for (q = 0; q < 2 && x + 2 * q < x1; q++) {
+                qx[n] = x + 2 * q;
+                px = nv_quad_x + (float)qx[n];
+                py = nv_quad_y + (float)y;
+                for (i = 0; i < 3; i++) {
+                    l[n][i] = px * t->bary[i][0] + py * t->bary[i][1] +
+                              t->bary[i][2];
+                }
+
+                any = false;
+                for (k = 0; k < NV_ENGINE_BATCH; k++) {
+                    fx = qx[n] + (k & 1);
+                    fy = y + (k >> 1);
+                    live[n][k] = fx >= x0 && fx < x1 && fy >= y0 &&
+                                 fy < y1 &&
+                                 nv_inside(t->bary[0], l[n][0][k]) &&
+                                 nv_inside(t->bary[1], l[n][1][k]) &&
+                                 nv_inside(t->bary[2], l[n][2][k]);
+                    if (live[n][k] && rt->zeta) {
+                        zp[n][k] = rt->zeta + fy * rt->zeta_pitch +
+                                   fx * rt->zeta_bpp;
+                        depth[n][k] = nv_depth_value(ops,
+                                                     l[n][0][k] * v[0].z +
+                                                     l[n][1][k] * v[1].z +
+                                                     l[n][2][k] * v[2].z);
+                        live[n][k] = nv_depth_test(rt, ops, zp[n][k],
+                                                   depth[n][k]);
+                    }
+                    any |= live[n][k];
+                }
+                n += any;
+            }
+            if (!n) {
+                continue;
+            }
+
+            nv_shade_quads(ops, t, (const NVVecF (*)[3])l, c, n);
+            for (q = 0; q < n; q++) {
+                for (k = 0; k < NV_ENGINE_BATCH; k++) {
+                    if (!live[q][k]) {
+                        continue;
+                    }
+                    for (j = 0; j < 4; j++) {
+                        frag[j] = c[q][j][k];
+                    }
+                    if (ops->alpha_test &&
+                        !nv_compare(ops->alpha_func, frag[3],
+                                    ops->alpha_ref)) {
+                        continue;
+                    }
+                    if (rt->zeta) {
+                        nv_depth_write(rt, ops, zp[q][k], depth[q][k]);
+                    }
+                    cp = rt->color + (y + (k >> 1)) * rt->color_pitch +
+                         (qx[q] + (k & 1)) * rt->color_bpp;
+                    if (ops->blend) {
+                        nv_load_color(rt, cp, dst);
+                        nv_blend(ops, frag, dst);
+                        for (j = 0; j < 4; j++) {
+                            frag[j] = MIN(MAX(frag[j], 0), 1);
+                        }
+                    }
+                    nv_store_color(rt, ops, cp, frag);
+                    passed++;
+                }
+            }
+        }
+    }
+    return passed;
+}
+
+unsigned nv_raster_tile(const NVRenderTarget *rt, const NVRasterOps *ops,
+                        const NVTriangle *tris, const uint32_t *list,
+                        unsigned n, unsigned tx, unsigned ty)
+{
+    int x0 = MAX((int)(tx << NV_TILE_SHIFT), rt->x0);
+    int y0 = MAX((int)(ty << NV_TILE_SHIFT), rt->y0);
+    int x1 = MIN((int)((tx + 1) << NV_TILE_SHIFT), rt->x1);
+    int y1 = MIN((int)((ty + 1) << NV_TILE_SHIFT), rt->y1);
+    const NVTriangle *t;
+    unsigned i, passed = 0;
+
+    for (i = 0; i < n; i++) {
+        t = &tris[list[i]];
+        passed += nv_raster_triangle(rt, ops, t, MAX(x0, t->x0),
+                                     MAX(y0, t->y0), MIN(x1, t->x1),
+                                     MIN(y1, t->y1));
+    }
+    return passed;
+}
@@ -0,0 +1,250 @@
+/*
+ * NVIDIA GeForce3 texture sampling
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "host/cpuinfo.h"
+#include "geforce3_engine.h"
+#ifdef CONFIG_AVX2_OPT
+#include <immintrin.h>
+#endif
+
+/* A sampling quad is one batch */
+QEMU_BUILD_BUG_ON(NV_ENGINE_BATCH != 4);
+
+/*
+ * How one quad is filtered, from the footprint of its pixels.  The
+ * kernels take any number of quads that agree on level, linear and n.
+ */
+typedef struct NVSampleSetup {
+    unsigned level;         /* mip level */
+    float frac;             /* blend towards level + 1 */
+    bool linear;            /* bilinear within a level */
+    unsigned n;             /* probes along the major axis of the footprint */
+    float du, dv;           /* the major axis */
+} NVSampleSetup;
+
+/* Scale @coord of one quad to texels in @c and work out its filtering */
+static void nv_sample_setup(const NVTexture *tex, const NVVecF coord[3],
+                            NVVecF c[3], NVSampleSetup *p)
+{
+    NVVecF s = coord[0], t = coord[1], r = coord[2];
+    float dsdx, dtdx, dsdy, dtdy, px, py, pmax, pmin, lod;
+    unsigned last = tex->levels - 1, filter;
+
+    if (tex->normalized) {
+        s *= (float)tex->width;
+        t *= (float)tex->height;
+    }
+    if (tex->shadow) {
+        r *= (float)tex->depth_max;
+    }
+    c[0] = s;
+    c[1] = t;
+    c[2] = r;
+
+    /* Footprint of a pixel in texels, from the quad's neighbours */
+    dsdx = s[1] - s[0];
+    dtdx = t[1] - t[0];
+    dsdy = s[2] - s[0];
+    dtdy = t[2] - t[0];
+    px = sqrtf(dsdx * dsdx + dtdx * dtdx);
+    py = sqrtf(dsdy * dsdy + dtdy * dtdy);
+    pmax = MAX(px, py);
+    pmin = MIN(px, py);
+    if (!isfinite(pmax)) {
+        pmax = pmin = 1;
+    }
+
+    p->n = 1;
+    if (tex->max_aniso > 1 && pmin > 0) {
+        p->n = ceilf(MIN(pmax / pmin, tex->max_aniso));
+    }
+    p->du = px > py ? dsdx : dsdy;
+    p->dv = px > py ? dtdx : dtdy;
+    lod = pmax > 0 ? log2f(pmax / p->n) : -INFINITY;
+    lod = MIN(MAX(lod + tex->lod_bias, tex->min_lod), tex->max_lod);
+    filter = lod > 0 ? tex->min_filter : tex->mag_filter;
+    p->linear = filter != NV_TEX_NEAREST &&
+                filter != NV_TEX_NEAREST_MIPMAP_NEAREST &&
+                filter != NV_TEX_NEAREST_MIPMAP_LINEAR;
+
+    /* The mipmap part of the filter */
+    lod = MAX(lod, 0);
+    p->frac = 0;
+    switch (filter) {
+    case NV_TEX_NEAREST_MIPMAP_NEAREST:
+    case NV_TEX_LINEAR_MIPMAP_NEAREST:
+        p->level = MIN((unsigned)(lod + 0.5f), last);
+        break;
+    case NV_TEX_NEAREST_MIPMAP_LINEAR:
+    case NV_TEX_LINEAR_MIPMAP_LINEAR:
+        p->level = MIN((unsigned)lod, last);
+        p->frac = p->level < last ? lod - p->level : 0;
+        break;
+    default:
+        p->level = 0;
+        break;
+    }
+}
+
+static inline NVVecF nv_vfloor(NVVecF a)
+{
+    int i;
+
+    for (i = 0; i < NV_ENGINE_BATCH; i++) {
+        a[i] = floorf(a[i]);
+    }
+    return a;
+}
+
+static inline NVVecI nv_gather(const uint32_t *base, NVVecI index)
+{
+    NVVecI v;
+    int i;
+
+    for (i = 0; i < NV_ENGINE_BATCH; i++) {
+        v[i] = base[index[i]];
+    }
+    return v;
+}
+
+#define NV_SAMPLE_ISA generic
+#define NV_SAMPLE_ATTR
+#define NV_SAMPLE_LANES NV_ENGINE_BATCH
+#define NV_VF NVVecF
+#define NV_VI NVVecI
+#define NV_VFLOOR(a) nv_vfloor(a)
+#define NV_GATHER(base, index) nv_gather(base, index)
+#include "geforce3_sample.c.inc"
+#undef NV_SAMPLE_ISA
+#undef NV_SAMPLE_ATTR
+#undef NV_VFLOOR
+#undef NV_GATHER
+
+#ifdef CONFIG_AVX2_OPT
+#define NV_SAMPLE_ISA sse41
+#define NV_SAMPLE_ATTR __attribute__((target("sse4.1")))
+#define NV_VFLOOR(a) ((NVVecF)_mm_floor_ps((__m128)(a)))
+#define NV_GATHER(base, index) nv_gather(base, index)
+#include "geforce3_sample.c.inc"
+#undef NV_SAMPLE_ISA
+#undef NV_SAMPLE_ATTR
+#undef NV_SAMPLE_LANES
+#undef NV_VF
+#undef NV_VI
+#undef NV_VFLOOR
+#undef NV_GATHER
+
+/* AVX2 filters two quads at once, lanes 0-3 and 4-7 */
+typedef float NVVec8F __attribute__((vector_size(32)));
+typedef int32_t NVVec8I __attribute__((vector_size(32)));
+
+#define NV_SAMPLE_ISA avx2
+#define NV_SAMPLE_ATTR __attribute__((target("avx2")))
+#define NV_SAMPLE_LANES 8
+#define NV_VF NVVec8F
+#define NV_VI NVVec8I
+#define NV_VFLOOR(a) ((NVVec8F)_mm256_floor_ps((__m256)(a)))
+#define NV_GATHER(base, index) \
+    ((NVVec8I)_mm256_i32gather_epi32((const int *)(base), (__m256i)(index), 4))
+#include "geforce3_sample.c.inc"
+#undef NV_SAMPLE_ISA
+#undef NV_SAMPLE_LANES
+#undef NV_VF
+#undef NV_VI
+#undef NV_VFLOOR
+#undef NV_GATHER
+
+static inline NV_SAMPLE_ATTR NVVec8F nv_vjoin(NVVecF lo, NVVecF hi)
+{
+    return (NVVec8F)_mm256_set_m128((__m128)hi, (__m128)lo);
+}
+
+static NV_SAMPLE_ATTR
+void nv_sample_pair_avx2(const NVTexture *tex, const NVVecF coord[2][3],
+                         NVVecF out[2][4])
+{
+    NVSampleSetup p[2];
+    NVVecF c[2][3], zero = { };
+    NVVec8F res[4];
+    int i, j;
+
+    nv_sample_setup(tex, coord[0], c[0], &p[0]);
+    nv_sample_setup(tex, coord[1], c[1], &p[1]);
+    if (p[0].level != p[1].level || p[0].linear != p[1].linear ||
+        p[0].n != p[1].n) {
+        for (i = 0; i < 2; i++) {
+            nv_sample_span_sse41(tex, &p[i], zero + p[i].frac,
+                                 zero + p[i].du, zero + p[i].dv,
+                                 c[i][0], c[i][1], c[i][2], out[i]);
+        }
+        return;
+    }
+
+    nv_sample_span_avx2(tex, &p[0],
+                        nv_vjoin(zero + p[0].frac, zero + p[1].frac),
+                        nv_vjoin(zero + p[0].du, zero + p[1].du),
+                        nv_vjoin(zero + p[0].dv, zero + p[1].dv),
+                        nv_vjoin(c[0][0], c[1][0]),
+                        nv_vjoin(c[0][1], c[1][1]),
+                        nv_vjoin(c[0][2], c[1][2]), res);
+    for (j = 0; j < 4; j++) {
+        out[0][j] = (NVVecF)_mm256_castps256_ps128((__m256)res[j]);
+        out[1][j] = (NVVecF)_mm256_extractf128_ps((__m256)res[j], 1);
+    }
+}
+#undef NV_SAMPLE_ATTR
+#endif
+
+typedef void NVSampleSpanFn(const NVTexture *tex, const NVSampleSetup *p,
+                            NVVecF frac, NVVecF du, NVVecF dv, NVVecF s,
+                            NVVecF t, NVVecF r, NVVecF out[4]);
+typedef void NVSamplePairFn(const NVTexture *tex, const NVVecF coord[2][3],
+                            NVVecF out[2][4]);
+
+static NVSampleSpanFn *nv_sample_fn = nv_sample_span_generic;
+static NVSamplePairFn *nv_sample_pair_fn;
+
+static void __attribute__((constructor)) nv_sample_init(void)
+{
+#ifdef CONFIG_AVX2_OPT
+    unsigned info = cpuinfo_init();
+
+    if (info & CPUINFO_AVX2) {
+        nv_sample_fn = nv_sample_span_sse41;
+        nv_sample_pair_fn = nv_sample_pair_avx2;
+    } else if (info & CPUINFO_SSE4) {
+        nv_sample_fn = nv_sample_span_sse41;
+    }
+#endif
+}
+
+void nv_sample_quad(const NVTexture *tex, const NVVecF coord[3],
+                    NVVecF out[4])
+{
+    NVSampleSetup p;
+    NVVecF c[3], zero = { };
+
+    nv_sample_setup(tex, coord, c, &p);
+    nv_sample_fn(tex, &p, zero + p.frac, zero + p.du, zero + p.dv,
+                 c[0], c[1], c[2], out);
+}
+
+void nv_sample_pair(const NVTexture *tex, const NVVecF coord[2][3],
+                    NVVecF out[2][4])
+{
+    if (nv_sample_pair_fn) {
+        nv_sample_pair_fn(tex, coord, out);
+        return;
+    }
+    nv_sample_quad(tex, coord[0], out[0]);
+    nv_sample_quad(tex, coord[1], out[1]);
+}
@@ -0,0 +1,208 @@
+/*
+ * NVIDIA GeForce3 texel formats and texture decoding
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "geforce3_engine.h"
+
+unsigned nv_texel_size(unsigned format)
+{
+    switch (format) {
+    case NV_TEXEL_L8:
+    case NV_TEXEL_AL8:
+    case NV_TEXEL_A8:
+        return 1;
+    case NV_TEXEL_A1R5G5B5:
+    case NV_TEXEL_X1R5G5B5:
+    case NV_TEXEL_A4R4G4B4:
+    case NV_TEXEL_R5G6B5:
+    case NV_TEXEL_R16:
+        return 2;
+    case NV_TEXEL_A8R8G8B8:
+    case NV_TEXEL_X8R8G8B8:
+    case NV_TEXEL_R32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static inline uint32_t nv_expand5(uint32_t v)
+{
+    return (v << 3) | (v >> 2);
+}
+
+static inline uint32_t nv_texel(unsigned format, uint32_t v)
+{
+    switch (format) {
+    case NV_TEXEL_L8:
+        return 0xff000000 | v * 0x010101;
+    case NV_TEXEL_AL8:
+        return v * 0x01010101;
+    case NV_TEXEL_A8:
+        return v << 24;
+    case NV_TEXEL_A1R5G5B5:
+    case NV_TEXEL_X1R5G5B5:
+        return (v & 0x8000 || format == NV_TEXEL_X1R5G5B5 ? 0xff000000 : 0) |
+               nv_expand5((v >> 10) & 0x1f) << 16 |
+               nv_expand5((v >> 5) & 0x1f) << 8 | nv_expand5(v & 0x1f);
+    case NV_TEXEL_A4R4G4B4:
+        return ((v >> 12) & 0xf) * 0x11000000 | ((v >> 8) & 0xf) * 0x110000 |
+               ((v >> 4) & 0xf) * 0x1100 | (v & 0xf) * 0x11;
+    case NV_TEXEL_R5G6B5:
+        return 0xff000000 | nv_expand5((v >> 11) & 0x1f) << 16 |
+               (((v >> 5) & 0x3f) << 2 | ((v >> 9) & 0x3)) << 8 |
+               nv_expand5(v & 0x1f);
+    case NV_TEXEL_X8R8G8B8:
+        return 0xff000000 | v;
+    default:
+        return v;
+    }
+}
+
+static inline uint32_t nv_load_texel(const uint8_t *p, unsigned bpp)
+{
+    return bpp == 1 ? *p : bpp == 2 ? lduw_le_p(p) : ldl_le_p(p);
+}
+
+/* Swizzled textures interleave the x and y address bits, x first */
+static void nv_swizzle_masks(unsigned width, unsigned height,
+                             uint32_t *mask_x, uint32_t *mask_y)
+{
+    uint32_t bit = 1;
+    unsigned i;
+
+    *mask_x = *mask_y = 0;
+    for (i = 1; i < width || i < height; i <<= 1) {
+        if (i < width) {
+            *mask_x |= bit;
+            bit <<= 1;
+        }
+        if (i < height) {
+            *mask_y |= bit;
+            bit <<= 1;
+        }
+    }
+}
+
+/* Next address along one axis: add one to the bits under @mask */
+static inline uint32_t nv_swizzle_next(uint32_t off, uint32_t mask)
+{
+    return ((off | ~mask) + 1) & mask;
+}
+
+size_t nv_texture_image_size(const NVTextureImage *img)
+{
+    unsigned bpp = nv_texel_size(img->format);
+    size_t size = 0;
+    unsigned l;
+
+    if (!img->swizzled) {
+        return (size_t)img->pitch * img->height;
+    }
+    for (l = 0; l < img->levels; l++) {
+        size += (size_t)MAX(img->width >> l, 1) *
+                MAX(img->height >> l, 1) * bpp;
+    }
+    return size;
+}
+
+size_t nv_texture_decoded_size(const NVTextureImage *img)
+{
+    unsigned levels = img->swizzled ? img->levels : 1;
+    size_t size = 0;
+    unsigned l;
+
+    for (l = 0; l < levels; l++) {
+        size += (size_t)MAX(img->width >> l, 1) * MAX(img->height >> l, 1) *
+                sizeof(uint32_t);
+    }
+    return size;
+}
+
+uint32_t *nv_texture_decode(const NVTextureImage *img, const uint8_t *raw,
+                            size_t *size)
+{
+    unsigned bpp = nv_texel_size(img->format);
+    unsigned levels = img->swizzled ? img->levels : 1;
+    unsigned l, x, y, w, h;
+    uint32_t *texels, *out, mask_x, mask_y, off_x, off_y;
+
+    *size = nv_texture_decoded_size(img);
+    out = texels = g_malloc(*size);
+
+    if (!img->swizzled) {
+        for (y = 0; y < img->height; y++) {
+            for (x = 0; x < img->width; x++) {
+                *out++ = nv_texel(img->format,
+                                  nv_load_texel(raw + y * img->pitch +
+                                                x * bpp, bpp));
+            }
+        }
+        return texels;
+    }
+
+    for (l = 0; l < levels; l++) {
+        w = MAX(img->width >> l, 1);
+        h = MAX(img->height >> l, 1);
+        nv_swizzle_masks(w, h, &mask_x, &mask_y);
+        for (y = 0, off_y = 0; y < h; y++) {
+            for (x = 0, off_x = 0; x < w; x++) {
+                *out++ = nv_texel(img->format,
+                                  nv_load_texel(raw + (off_x | off_y) * bpp,
+                                                bpp));
+                off_x = nv_swizzle_next(off_x, mask_x);
+            }
+            off_y = nv_swizzle_next(off_y, mask_y);
+        }
+        raw += w * h * bpp;
+    }
+    return texels;
+}
+
+/* A8R8G8B8 to R5G6B5, or X1R5G5B5 for any other 16 bit format */
+static inline uint32_t nv_pack16(unsigned format, uint32_t p)
+{
+    if (format == NV_TEXEL_R5G6B5) {
+        return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) |
+               ((p >> 3) & 0x001f);
+    }
+    return ((p >> 9) & 0x7c00) | ((p >> 6) & 0x03e0) | ((p >> 3) & 0x001f);
+}
+
+void nv_convert_pixels(uint8_t *dst, unsigned dst_format, const uint8_t *src,
+                       unsigned src_format, unsigned n)
+{
+    unsigned dbpp = nv_texel_size(dst_format);
+    unsigned sbpp = nv_texel_size(src_format);
+    uint32_t p;
+    unsigned i;
+
+    /*
+     * 32 bit formats only differ in how alpha is read, and raw formats
+     * have no layout to convert
+     */
+    if (sbpp == dbpp &&
+        (src_format == dst_format || sbpp == 4 ||
+         src_format == NV_TEXEL_R16 || dst_format == NV_TEXEL_R16)) {
+        memcpy(dst, src, n * dbpp);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        p = nv_texel(src_format, nv_load_texel(src + i * sbpp, sbpp));
+        if (dbpp == 4) {
+            stl_le_p(dst + i * 4, p);
+        } else {
+            stw_le_p(dst + i * 2, nv_pack16(dst_format, p));
+        }
+    }
+}
@@ -0,0 +1,320 @@
+/*
+ * NVIDIA GeForce3 fixed function transform and lighting
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "geforce3_engine.h"
+
+unsigned nv_attrib_size(uint32_t type, unsigned count)
+{
+    if (count > 4) {
+        return 0;
+    }
+    switch (type) {
+    case NV_ATTRIB_UB_D3D:
+    case NV_ATTRIB_UB_OGL:
+        return count;
+    case NV_ATTRIB_S1:
+    case NV_ATTRIB_S32K:
+        return count * 2;
+    case NV_ATTRIB_F:
+        return count * 4;
+    case NV_ATTRIB_CMP:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Attribute decode works on whole batches: the elements are first gathered
+ * into little endian 32-bit words, raw[w][lane], and each format then
+ * unpacks all lanes with vector shifts and conversions.
+ */
+typedef void NVUnpackFn(const NVVecI raw[4], NVVecF out[4]);
+
+static void nv_gather(const NVAttribStream *a, const uint32_t *index,
+                      unsigned n, unsigned size, NVVecI raw[4])
+{
+    uint8_t elem[16] = { };
+    unsigned i, w;
+
+    memset(raw, 0, sizeof(NVVecI) * 4);
+    for (i = 0; i < n; i++) {
+        memcpy(elem, a->base + (size_t)index[i] * a->stride,
+               MIN(size, sizeof(elem)));
+        for (w = 0; w < DIV_ROUND_UP(size, 4); w++) {
+            raw[w][i] = ldl_le_p(elem + w * 4);
+        }
+    }
+}
+
+static inline void nv_unpack_ub(const NVVecI raw[4], NVVecF out[4])
+{
+    int c;
+
+    for (c = 0; c < 4; c++) {
+        out[c] = nv_vcvt((raw[0] >> (c * 8)) & 0xff) * (1.0f / 255);
+    }
+}
+
+static void nv_unpack_ub_d3d(const NVVecI raw[4], NVVecF out[4])
+{
+    NVVecF t;
+
+    nv_unpack_ub(raw, out);
+    t = out[0];
+    out[0] = out[2];
+    out[2] = t;
+}
+
+/* Two shorts per word, sign extended in place */
+static inline NVVecI nv_unpack_short(const NVVecI raw[4], int c)
+{
+    return c & 1 ? raw[c / 2] >> 16 : (raw[c / 2] << 16) >> 16;
+}
+
+static void nv_unpack_s1(const NVVecI raw[4], NVVecF out[4])
+{
+    NVVecF min = { };
+    int c;
+
+    min -= 1;
+    for (c = 0; c < 4; c++) {
+        out[c] = nv_vmax(nv_vcvt(nv_unpack_short(raw, c)) * (1.0f / 32767),
+                         min);
+    }
+}
+
+static void nv_unpack_s32k(const NVVecI raw[4], NVVecF out[4])
+{
+    int c;
+
+    for (c = 0; c < 4; c++) {
+        out[c] = nv_vcvt(nv_unpack_short(raw, c));
+    }
+}
+
+static void nv_unpack_f(const NVVecI raw[4], NVVecF out[4])
+{
+    int c;
+
+    for (c = 0; c < 4; c++) {
+        out[c] = (NVVecF)raw[c];
+    }
+}
+
+/* 11:11:10 signed normalized */
+static void nv_unpack_cmp(const NVVecI raw[4], NVVecF out[4])
+{
+    NVVecF min = { };
+
+    min -= 1;
+    out[0] = nv_vmax(nv_vcvt((raw[0] << 21) >> 21) * (1.0f / 1023), min);
+    out[1] = nv_vmax(nv_vcvt((raw[0] << 10) >> 21) * (1.0f / 1023), min);
+    out[2] = nv_vmax(nv_vcvt(raw[0] >> 22) * (1.0f / 511), min);
+}
+
+static NVUnpackFn * const nv_unpack[8] = {
+    [NV_ATTRIB_UB_D3D] = nv_unpack_ub_d3d,
+    [NV_ATTRIB_S1] = nv_unpack_s1,
+    [NV_ATTRIB_F] = nv_unpack_f,
+    [NV_ATTRIB_UB_OGL] = nv_unpack_ub,
+    [NV_ATTRIB_S32K] = nv_unpack_s32k,
+    [NV_ATTRIB_CMP] = nv_unpack_cmp,
+};
+
+void nv_fetch_attrib(const NVAttribStream *a, const uint32_t *index,
+                     unsigned n, NVVecF out[4])
+{
+    unsigned size = nv_attrib_size(a->type, a->count);
+    unsigned count = a->type == NV_ATTRIB_CMP ? 3 : a->count;
+    NVUnpackFn *unpack = nv_unpack[a->type & 7];
+    NVVecI raw[4];
+    NVVecF zero = { };
+    unsigned c;
+
+    if (unpack && size) {
+        nv_gather(a, index, n, size, raw);
+        unpack(raw, out);
+    } else {
+        count = 0;
+    }
+    for (c = count; c < 4; c++) {
+        out[c] = c == 3 ? zero + 1 : zero;
+    }
+}
+
+/* out = in * m for NV_ENGINE_BATCH row vectors at once */
+static inline void nv_vtransform(NVVecF out[4], const NVVecF in[4],
+                                 const float *m)
+{
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        out[j] = in[0] * m[j] + in[1] * m[4 + j] + in[2] * m[8 + j] +
+                 in[3] * m[12 + j];
+    }
+}
+
+static inline NVVecF nv_vdot3(const NVVecF v[3], const float *c)
+{
+    return v[0] * c[0] + v[1] * c[1] + v[2] * c[2];
+}
+
+static inline NVVecF nv_vdot4(const NVVecF v[4], const float *c)
+{
+    return v[0] * c[0] + v[1] * c[1] + v[2] * c[2] + v[3] * c[3];
+}
+
+static void nv_light_batch(const NVTnLState *st, const NVAttribBatch *in,
+                           NVVecF color[4], NVVecF spec[4])
+{
+    const NVVecF *n = in->v[NV_ATTR_NORMAL];
+    const NVVecF *diffuse = in->v[NV_ATTR_DIFFUSE];
+    const float *inv = st->inv_modelview;
+    NVVecF normal[3], len, ndotl, zero = { };
+    unsigned i;
+    int j;
+
+    /* Normals go through the inverse transpose of the modelview */
+    for (j = 0; j < 3; j++) {
+        normal[j] = n[0] * inv[j * 4] + n[1] * inv[j * 4 + 1] +
+                    n[2] * inv[j * 4 + 2];
+    }
+    if (st->normalize) {
+        len = normal[0] * normal[0] + normal[1] * normal[1] +
+              normal[2] * normal[2];
+        for (i = 0; i < NV_ENGINE_BATCH; i++) {
+            len[i] = len[i] > 0 ? 1.0f / sqrtf(len[i]) : 0;
+        }
+        for (j = 0; j < 3; j++) {
+            normal[j] *= len;
+        }
+    }
+
+    for (j = 0; j < 3; j++) {
+        color[j] = zero + st->emission[j] + st->scene_ambient[j];
+        spec[j] = zero;
+    }
+    for (i = 0; i < st->num_lights; i++) {
+        const NVLight *l = &st->light[i];
+
+        ndotl = nv_vmax(nv_vdot3(normal, l->dir), zero);
+        for (j = 0; j < 3; j++) {
+            color[j] += l->ambient[j] + ndotl * l->diffuse[j] *
+                        (st->diffuse_from_vertex ? diffuse[j] : zero + 1);
+        }
+    }
+    for (j = 0; j < 3; j++) {
+        color[j] = nv_vclamp(color[j], 0, 1);
+    }
+    color[3] = st->diffuse_from_vertex ? diffuse[3] :
+               zero + st->material_alpha;
+    spec[3] = zero + 1;
+}
+
+static void nv_texgen_batch(const NVTnLState *st, const NVAttribBatch *in,
+                            const NVVecF eye[4], NVVecF tex[][4])
+{
+    const NVVecF *obj = in->v[NV_ATTR_POSITION];
+    NVVecF t[4];
+    int i, j;
+
+    for (i = 0; i < NV_ENGINE_TEXTURES; i++) {
+        for (j = 0; j < 4; j++) {
+            switch (st->texgen_mode[i][j]) {
+            case NV_TEXGEN_OBJECT_LINEAR:
+                tex[i][j] = nv_vdot4(obj, st->texgen_plane[i][j]);
+                break;
+            case NV_TEXGEN_EYE_LINEAR:
+                tex[i][j] = nv_vdot4(eye, st->texgen_plane[i][j]);
+                break;
+            }
+        }
+        if (st->texture_matrix_enable[i]) {
+            nv_vtransform(t, tex[i], st->texture_matrix[i]);
+            memcpy(tex[i], t, sizeof(t));
+        }
+    }
+}
+
+/*
+ * One batch of vertices through fixed function T&L.  Instantiated once
+ * per lighting/texgen combination so the disabled stages cost nothing.
+ */
+static inline QEMU_ALWAYS_INLINE
+void nv_tnl_batch(const NVTnLState *st, const NVAttribBatch *in,
+                  NVVertex *out, const bool lighting, const bool texgen)
+{
+    NVVecF clip[4], eye[4], iw, win[3];
+    NVVecF color[4], spec[4], tex[NV_ENGINE_TEXTURES][4];
+    NVVecF zero = { };
+    unsigned i;
+    int j, k;
+
+    nv_vtransform(clip, in->v[NV_ATTR_POSITION], st->composite);
+    iw = nv_vsel(clip[3] > zero, 1.0f / clip[3], zero);
+    for (j = 0; j < 3; j++) {
+        win[j] = clip[j] * iw + st->viewport_offset[j];
+    }
+
+    if (lighting) {
+        nv_light_batch(st, in, color, spec);
+    } else {
+        memcpy(color, in->v[NV_ATTR_DIFFUSE], sizeof(color));
+        memcpy(spec, in->v[NV_ATTR_SPECULAR], sizeof(spec));
+    }
+
+    memcpy(tex, &in->v[NV_ATTR_TEXTURE0], sizeof(tex));
+    if (texgen) {
+        nv_vtransform(eye, in->v[NV_ATTR_POSITION], st->modelview);
+        nv_texgen_batch(st, in, eye, tex);
+    }
+
+    for (i = 0; i < in->count; i++) {
+        NVVertex *v = &out[i];
+
+        v->x = win[0][i];
+        v->y = win[1][i];
+        v->z = win[2][i];
+        v->iw = iw[i];
+        for (j = 0; j < 4; j++) {
+            v->color[j] = color[j][i];
+            v->spec[j] = spec[j][i];
+            for (k = 0; k < NV_ENGINE_TEXTURES; k++) {
+                v->tex[k][j] = tex[k][j][i];
+            }
+        }
+    }
+}
+
+#define NV_TNL_VARIANT(name, lighting, texgen) \
+    static void name(const NVTnLState *st, const NVAttribBatch *in, \
+                     NVVertex *out) \
+    { \
+        nv_tnl_batch(st, in, out, lighting, texgen); \
+    }
+
+NV_TNL_VARIANT(nv_tnl_plain, false, false)
+NV_TNL_VARIANT(nv_tnl_lit, true, false)
+NV_TNL_VARIANT(nv_tnl_texgen, false, true)
+NV_TNL_VARIANT(nv_tnl_lit_texgen, true, true)
+
+NVTnLFn *nv_tnl_select(const NVTnLState *st)
+{
+    static NVTnLFn * const variants[2][2] = {
+        { nv_tnl_plain, nv_tnl_texgen },
+        { nv_tnl_lit, nv_tnl_lit_texgen },
+    };
+
+    return variants[st->lighting][st->texgen];
+}
@@ -0,0 +1,144 @@
+/*
+ * NVIDIA GeForce3 video BIOS image
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "geforce3_vbios.h"
+
+/* Image layout; 0x36 is where drivers look for the DCB pointer */
+#define NV_ROM_ENTRY            0x03
+#define NV_ROM_PCIR_PTR         0x18
+#define NV_ROM_DCB_PTR          0x36
+#define NV_ROM_PCIR             0x40
+#define NV_ROM_BIT              0x60
+#define NV_ROM_BIT_INFO         0x80
+#define NV_ROM_BIT_INIT         0x90
+#define NV_ROM_INIT_SCRIPTS     0xa0
+#define NV_ROM_INIT_SCRIPT0     0xa8
+#define NV_ROM_DCB              0x100
+#define NV_ROM_I2C              0x140
+
+/* BIT: BIOS information table, a list of ids with their data */
+#define NV_BIT_HEADER_SIZE      12
+#define NV_BIT_ENTRY_SIZE       6
+#define NV_BIT_INFO_SIZE        15
+#define NV_BIT_INIT_SIZE        14
+
+/* Reported as version 3.20.00.10, NV20 era */
+#define NV_VBIOS_VERSION        0x03200010
+
+#define NV_INIT_DONE            0x71
+
+/* DCB 3.0 and its I2C port table */
+#define NV_DCB_VERSION          0x30
+#define NV_DCB_HEADER_SIZE      16
+#define NV_DCB_ENTRY_SIZE       8
+#define NV_DCB_SIGNATURE        0x4edcbdcb
+#define NV_DCB_TYPE_ANALOG      0x0
+#define NV_DCB_TYPE_EOL         0xe
+#define NV_DCB_I2C_HEADER_SIZE  5
+#define NV_DCB_I2C_ENTRY_SIZE   4
+#define NV_DCB_I2C_NV04_BIT     0x00
+#define NV_CIO_CRE_DDC_STATUS   0x3e
+#define NV_CIO_CRE_DDC_WR       0x3f
+
+static uint8_t nv_vbios_checksum(const uint8_t *p, size_t len)
+{
+    uint8_t sum = 0;
+
+    while (len--) {
+        sum += *p++;
+    }
+    return -sum;
+}
+
+static void nv_vbios_bit_entry(uint8_t *p, char id, uint16_t len,
+                               uint16_t offset)
+{
+    p[0] = id;
+    p[1] = 1;
+    stw_le_p(p + 2, len);
+    stw_le_p(p + 4, offset);
+}
+
+void nv_vbios_build(uint8_t *rom, uint16_t vendor, uint16_t device)
+{
+    static const uint8_t bit_signature[] = { 0xff, 0xb8, 'B', 'I', 'T', 0 };
+    uint8_t *p;
+
+    memset(rom, 0, NV_VBIOS_SIZE);
+
+    /* Expansion ROM header; the entry point is a bare far return */
+    stw_le_p(rom, 0xaa55);
+    rom[2] = NV_VBIOS_SIZE / 512;
+    rom[NV_ROM_ENTRY] = 0xcb;
+    stw_le_p(rom + NV_ROM_PCIR_PTR, NV_ROM_PCIR);
+    stw_le_p(rom + NV_ROM_DCB_PTR, NV_ROM_DCB);
+
+    p = rom + NV_ROM_PCIR;
+    memcpy(p, "PCIR", 4);
+    stw_le_p(p + 0x04, vendor);
+    stw_le_p(p + 0x06, device);
+    stw_le_p(p + 0x0a, 0x18);
+    p[0x0f] = 0x03;                             /* VGA compatible */
+    stw_le_p(p + 0x10, NV_VBIOS_SIZE / 512);
+    p[0x14] = 0x00;                             /* x86 image */
+    p[0x15] = 0x80;                             /* last image */
+
+    p = rom + NV_ROM_BIT;
+    memcpy(p, bit_signature, sizeof(bit_signature));
+    stw_le_p(p + 6, 0x0100);
+    p[8] = NV_BIT_HEADER_SIZE;
+    p[9] = NV_BIT_ENTRY_SIZE;
+    p[10] = 2;
+    p[11] = nv_vbios_checksum(p, NV_BIT_HEADER_SIZE);
+    nv_vbios_bit_entry(p + NV_BIT_HEADER_SIZE, 'i', NV_BIT_INFO_SIZE,
+                       NV_ROM_BIT_INFO);
+    nv_vbios_bit_entry(p + NV_BIT_HEADER_SIZE + NV_BIT_ENTRY_SIZE, 'I',
+                       NV_BIT_INIT_SIZE, NV_ROM_BIT_INIT);
+
+    /* 'i': version, no feature bits and no DAC load detection table */
+    stl_le_p(rom + NV_ROM_BIT_INFO, NV_VBIOS_VERSION);
+
+    /*
+     * 'I': one init script that is done right away.  Firmware brought the
+     * display up already; there is no memory training to replay.
+     */
+    stw_le_p(rom + NV_ROM_BIT_INIT, NV_ROM_INIT_SCRIPTS);
+    stw_le_p(rom + NV_ROM_INIT_SCRIPTS, NV_ROM_INIT_SCRIPT0);
+    rom[NV_ROM_INIT_SCRIPT0] = NV_INIT_DONE;
+
+    /* DCB: the analog output on head 0 up to 400 MHz, then end of list */
+    p = rom + NV_ROM_DCB;
+    p[0] = NV_DCB_VERSION;
+    p[1] = NV_DCB_HEADER_SIZE;
+    p[2] = 2;
+    p[3] = NV_DCB_ENTRY_SIZE;
+    stw_le_p(p + 4, NV_ROM_I2C);
+    stl_le_p(p + 6, NV_DCB_SIGNATURE);
+    p += NV_DCB_HEADER_SIZE;
+    stl_le_p(p, NV_DCB_TYPE_ANALOG | (1 << 8) | (1 << 24));
+    stl_le_p(p + 4, 40);
+    stl_le_p(p + NV_DCB_ENTRY_SIZE, NV_DCB_TYPE_EOL);
+
+    /* DDC is bit banged through the extended CRTC registers */
+    p = rom + NV_ROM_I2C;
+    p[0] = NV_DCB_VERSION;
+    p[1] = NV_DCB_I2C_HEADER_SIZE;
+    p[2] = 1;
+    p[3] = NV_DCB_I2C_ENTRY_SIZE;
+    p += NV_DCB_I2C_HEADER_SIZE;
+    p[0] = NV_CIO_CRE_DDC_WR;
+    p[1] = NV_CIO_CRE_DDC_STATUS;
+    p[3] = NV_DCB_I2C_NV04_BIT;
+
+    rom[NV_VBIOS_SIZE - 1] = nv_vbios_checksum(rom, NV_VBIOS_SIZE - 1);
+}
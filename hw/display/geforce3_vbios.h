@@ -0,0 +1,27 @@
+/*
+ * NVIDIA GeForce3 video BIOS image
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GEFORCE3_VBIOS_H
+#define GEFORCE3_VBIOS_H
+
+/* Size of the built-in image, a valid PCI expansion ROM BAR size */
+#define NV_VBIOS_SIZE           0x1000
+
+/*
+ * Build the option ROM for a @vendor:@device card into @rom, which holds
+ * NV_VBIOS_SIZE bytes.  The image carries the tables drivers parse
+ * instead of probing: the BIT table with the version ('i') and init
+ * script ('I') entries, and a DCB with the analog output and its DDC
+ * port.  It has no x86 code, the entry point returns at once.
+ */
+void nv_vbios_build(uint8_t *rom, uint16_t vendor, uint16_t device);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ * NVIDIA GeForce3 engine kernel benchmark
+ *
+ * Copyright (c) 2025 QEMU Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Runs the engine kernels on synthetic data, without a device or a guest,
+ * and reports pixels per second and host ticks per pixel for each format,
+ * filter and size.  Ticks are TSC cycles on x86 hosts.
+ *
+ *   geforce3-bench [-t <ms per configuration>] [kernel...]
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "geforce3_engine.h"
+
+/* Blend state, GL enums as in NVRasterOps */
+#define NV_BENCH_SRC_ALPHA              0x0302
+#define NV_BENCH_ONE_MINUS_SRC_ALPHA    0x0303
+#define NV_BENCH_FUNC_ADD               0x8006
+
+/* Triangles in the raster benchmark are halves of cells this wide */
+#define NV_BENCH_CELL           32
+
+typedef uint64_t NVBenchFn(void *opaque);
+
+static int64_t bench_ns = 200 * SCALE_MS;
+static char **bench_filter;
+
+static const unsigned bench_sizes[] = { 64, 256, 1024 };
+
+static bool nv_bench_wanted(const char *kernel)
+{
+    char **f;
+
+    if (!bench_filter || !*bench_filter) {
+        return true;
+    }
+    for (f = bench_filter; *f; f++) {
+        if (!strcmp(*f, kernel)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Call @fn until the time budget is spent, @fn returns pixels done */
+static void nv_bench_run(const char *kernel, const char *config,
+                         NVBenchFn *fn, void *opaque)
+{
+    uint64_t pixels = 0;
+    int64_t start, ns, ticks;
+
+    /* Warm up caches and the sampler's ISA selection */
+    fn(opaque);
+
+    start = get_clock();
+    ticks = cpu_get_host_ticks();
+    do {
+        pixels += fn(opaque);
+        ns = get_clock() - start;
+    } while (ns < bench_ns);
+    ticks = cpu_get_host_ticks() - ticks;
+
+    printf("%-8s %-30s %10.1f MPix/s %9.2f cycles/pixel\n", kernel, config,
+           pixels * 1e3 / ns, (double)ticks / pixels);
+}
+
+/* Reproducible noise, so runs compare */
+static void nv_bench_fill(uint8_t *buf, size_t len)
+{
+    uint32_t x = 0x12345678;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        x = x * 1664525 + 1013904223;
+        buf[i] = x >> 24;
+    }
+}
+
+static const struct {
+    unsigned format;
+    const char *name;
+} bench_formats[] = {
+    { NV_TEXEL_L8, "L8" },
+    { NV_TEXEL_A1R5G5B5, "A1R5G5B5" },
+    { NV_TEXEL_X1R5G5B5, "X1R5G5B5" },
+    { NV_TEXEL_A4R4G4B4, "A4R4G4B4" },
+    { NV_TEXEL_R5G6B5, "R5G6B5" },
+    { NV_TEXEL_A8R8G8B8, "A8R8G8B8" },
+    { NV_TEXEL_X8R8G8B8, "X8R8G8B8" },
+};
+
+static const char *nv_bench_format_name(unsigned format)
+{
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(bench_formats); i++) {
+        if (bench_formats[i].format == format) {
+            return bench_formats[i].name;
+        }
+    }
+    return "?";
+}
+
+/* Full mip chain down to 1x1 */
+static unsigned nv_bench_levels(unsigned size)
+{
+    return ctz32(size) + 1;
+}
+
+typedef struct NVBenchDecode {
+    NVTextureImage img;
+    uint8_t *raw;
+} NVBenchDecode;
+
+static uint64_t nv_bench_decode_fn(void *opaque)
+{
+    NVBenchDecode *d = opaque;
+    uint32_t *texels;
+    size_t size;
+
+    texels = nv_texture_decode(&d->img, d->raw, &size);
+    g_free(texels);
+    return size / sizeof(uint32_t);
+}
+
+static void nv_bench_decode(void)
+{
+    NVBenchDecode d;
+    char config[64];
+    unsigned f, i, size, swizzled;
+    size_t len;
+
+    for (f = 0; f < ARRAY_SIZE(bench_formats); f++) {
+        for (swizzled = 0; swizzled < 2; swizzled++) {
+            for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+                size = bench_sizes[i];
+                d.img = (NVTextureImage) {
+                    .format = bench_formats[f].format,
+                    .swizzled = swizzled,
+                    .width = size,
+                    .height = size,
+                    .levels = swizzled ? nv_bench_levels(size) : 1,
+                    .pitch = size * nv_texel_size(bench_formats[f].format),
+                };
+                len = nv_texture_image_size(&d.img);
+                d.raw = g_malloc(len);
+                nv_bench_fill(d.raw, len);
+
+                snprintf(config, sizeof(config), "%s %s %ux%u",
+                         bench_formats[f].name,
+                         swizzled ? "swizzled" : "linear", size, size);
+                nv_bench_run("decode", config, nv_bench_decode_fn, &d);
+                g_free(d.raw);
+            }
+        }
+    }
+}
+
+typedef struct NVBenchConvert {
+    unsigned src_format, dst_format;
+    uint8_t *src, *dst;
+    unsigned n;
+} NVBenchConvert;
+
+static uint64_t nv_bench_convert_fn(void *opaque)
+{
+    NVBenchConvert *c = opaque;
+
+    nv_convert_pixels(c->dst, c->dst_format, c->src, c->src_format, c->n);
+    return c->n;
+}
+
+static void nv_bench_convert(void)
+{
+    /* The IFC uploads drivers do: 16 bit expands, packs and both copies */
+    static const unsigned pairs[][2] = {
+        { NV_TEXEL_R5G6B5, NV_TEXEL_A8R8G8B8 },
+        { NV_TEXEL_X1R5G5B5, NV_TEXEL_A8R8G8B8 },
+        { NV_TEXEL_A8R8G8B8, NV_TEXEL_R5G6B5 },
+        { NV_TEXEL_A8R8G8B8, NV_TEXEL_X1R5G5B5 },
+        { NV_TEXEL_X1R5G5B5, NV_TEXEL_R5G6B5 },
+        { NV_TEXEL_R5G6B5, NV_TEXEL_R5G6B5 },
+        { NV_TEXEL_A8R8G8B8, NV_TEXEL_X8R8G8B8 },
+    };
+    NVBenchConvert c;
+    char config[64];
+    unsigned p, i, size;
+
+    for (p = 0; p < ARRAY_SIZE(pairs); p++) {
+        for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+            size = bench_sizes[i];
+            c.src_format = pairs[p][0];
+            c.dst_format = pairs[p][1];
+            c.n = size * size;
+            c.src = g_malloc(c.n * nv_texel_size(c.src_format));
+            c.dst = g_malloc(c.n * nv_texel_size(c.dst_format));
+            nv_bench_fill(c.src, c.n * nv_texel_size(c.src_format));
+
+            snprintf(config, sizeof(config), "%s to %s %ux%u",
+                     nv_bench_format_name(c.src_format),
+                     nv_bench_format_name(c.dst_format), size, size);
+            nv_bench_run("convert", config, nv_bench_convert_fn, &c);
+            g_free(c.src);
+            g_free(c.dst);
+        }
+    }
+}
+
+/* Decoded A8R8G8B8 texture of @size with a full mip chain */
+static uint32_t *nv_bench_texture(NVTexture *tex, unsigned size)
+{
+    NVTextureImage img = {
+        .format = NV_TEXEL_A8R8G8B8,
+        .swizzled = true,
+        .width = size,
+        .height = size,
+        .levels = nv_bench_levels(size),
+    };
+    uint32_t *texels, offset = 0;
+    uint8_t *raw;
+    size_t len;
+    unsigned l;
+
+    len = nv_texture_image_size(&img);
+    raw = g_malloc(len);
+    nv_bench_fill(raw, len);
+    texels = nv_texture_decode(&img, raw, &len);
+    g_free(raw);
+
+    *tex = (NVTexture) {
+        .texels = texels,
+        .width = size,
+        .height = size,
+        .levels = img.levels,
+        .stride = size,
+        .normalized = true,
+        .wrap_u = NV_TEX_WRAP,
+        .wrap_v = NV_TEX_WRAP,
+        .min_filter = NV_TEX_LINEAR,
+        .mag_filter = NV_TEX_LINEAR,
+        .max_lod = img.levels - 1,
+        .max_aniso = 1,
+    };
+    for (l = 0; l < img.levels; l++) {
+        tex->level_offset[l] = offset;
+        offset += MAX(size >> l, 1) * MAX(size >> l, 1);
+    }
+    return texels;
+}
+
+static const struct {
+    const char *name;
+    unsigned min_filter, mag_filter, max_aniso;
+    float scale_s, scale_t;     /* texels of level 0 per pixel */
+} bench_filters[] = {
+    { "nearest", NV_TEX_NEAREST, NV_TEX_NEAREST, 1, 1, 1 },
+    { "bilinear", NV_TEX_LINEAR, NV_TEX_LINEAR, 1, 1, 1 },
+    { "trilinear", NV_TEX_LINEAR_MIPMAP_LINEAR, NV_TEX_LINEAR, 1, 1.5, 1.5 },
+    { "aniso4", NV_TEX_LINEAR_MIPMAP_LINEAR, NV_TEX_LINEAR, 4, 1.5, 6 },
+};
+
+/* Quads sampled per call, a square of this many on a side */
+#define NV_BENCH_QUADS          128
+
+typedef struct NVBenchSample {
+    NVTexture tex;
+    float scale_s, scale_t;
+    float sink;
+} NVBenchSample;
+
+static uint64_t nv_bench_sample_fn(void *opaque)
+{
+    static const NVVecF quad_x = { 0.5f, 1.5f, 0.5f, 1.5f };
+    static const NVVecF quad_y = { 0.5f, 0.5f, 1.5f, 1.5f };
+    NVBenchSample *b = opaque;
+    NVVecF coord[2][3] = { }, out[2][4], sum = { };
+    float ds = b->scale_s / b->tex.width, dt = b->scale_t / b->tex.height;
+    unsigned x, y, q;
+
+    /* Side by side pairs, as the rasterizer shades them */
+    for (y = 0; y < 2 * NV_BENCH_QUADS; y += 2) {
+        for (x = 0; x < 2 * NV_BENCH_QUADS; x += 4) {
+            for (q = 0; q < 2; q++) {
+                coord[q][0] = (quad_x + (float)(x + 2 * q)) * ds;
+                coord[q][1] = (quad_y + (float)y) * dt;
+            }
+            nv_sample_pair(&b->tex, coord, out);
+            sum += out[0][0] + out[1][0];
+        }
+    }
+    b->sink += sum[0];
+    return NV_BENCH_QUADS * NV_BENCH_QUADS * NV_ENGINE_BATCH;
+}
+
+static void nv_bench_sample(void)
+{
+    NVBenchSample b;
+    uint32_t *texels;
+    char config[64];
+    unsigned f, i, size;
+
+    for (f = 0; f < ARRAY_SIZE(bench_filters); f++) {
+        for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+            size = bench_sizes[i];
+            texels = nv_bench_texture(&b.tex, size);
+            b.tex.min_filter = bench_filters[f].min_filter;
+            b.tex.mag_filter = bench_filters[f].mag_filter;
+            b.tex.max_aniso = bench_filters[f].max_aniso;
+            b.scale_s = bench_filters[f].scale_s;
+            b.scale_t = bench_filters[f].scale_t;
+            b.sink = 0;
+
+            snprintf(config, sizeof(config), "%s %ux%u",
+                     bench_filters[f].name, size, size);
+            nv_bench_run("sample", config, nv_bench_sample_fn, &b);
+            g_free(texels);
+        }
+    }
+}
+
+typedef struct NVBenchRaster {
+    NVRenderTarget rt;
+    NVRasterOps ops;
+    NVVertex *v;
+    uint32_t (*prim)[3];
+    unsigned n;
+    NVTriangle *tris;
+    uint32_t *list;
+} NVBenchRaster;
+
+/* Set up the whole grid, then walk every tile with every triangle in it */
+static uint64_t nv_bench_raster_fn(void *opaque)
+{
+    NVBenchRaster *r = opaque;
+    unsigned tx, ty, tw, th, i, n, count;
+    uint64_t passed = 0;
+    int x0, y0;
+
+    count = nv_setup_triangles(r->tris, r->v, r->prim, r->n, &r->rt,
+                               &r->ops);
+    tw = DIV_ROUND_UP(r->rt.x1, NV_TILE_SIZE);
+    th = DIV_ROUND_UP(r->rt.y1, NV_TILE_SIZE);
+    for (ty = 0; ty < th; ty++) {
+        for (tx = 0; tx < tw; tx++) {
+            x0 = tx << NV_TILE_SHIFT;
+            y0 = ty << NV_TILE_SHIFT;
+            for (i = 0, n = 0; i < count; i++) {
+                if (r->tris[i].x1 > x0 && r->tris[i].x0 < x0 + NV_TILE_SIZE &&
+                    r->tris[i].y1 > y0 && r->tris[i].y0 < y0 + NV_TILE_SIZE) {
+                    r->list[n++] = i;
+                }
+            }
+            passed += nv_raster_tile(&r->rt, &r->ops, r->tris, r->list, n,
+                                     tx, ty);
+        }
+    }
+    return passed;
+}
+
+/* Two triangles per cell, covering the target once */
+static void nv_bench_grid(NVBenchRaster *r, unsigned size)
+{
+    unsigned cells = size / NV_BENCH_CELL, x, y, i, j;
+    NVVertex *v;
+
+    r->v = g_new0(NVVertex, (cells + 1) * (cells + 1));
+    for (y = 0; y <= cells; y++) {
+        for (x = 0; x <= cells; x++) {
+            v = &r->v[y * (cells + 1) + x];
+            v->x = x * NV_BENCH_CELL;
+            v->y = y * NV_BENCH_CELL;
+            v->z = 0x8000;
+            v->iw = 1;
+            v->color[0] = (float)x / cells;
+            v->color[1] = (float)y / cells;
+            v->color[2] = 0.5f;
+            v->color[3] = 0.5f;
+            v->tex[0][0] = (float)x / cells;
+            v->tex[0][1] = (float)y / cells;
+            v->tex[0][3] = 1;
+        }
+    }
+
+    r->n = cells * cells * 2;
+    r->prim = g_malloc_n(r->n, sizeof(*r->prim));
+    for (y = 0, j = 0; y < cells; y++) {
+        for (x = 0; x < cells; x++) {
+            i = y * (cells + 1) + x;
+            r->prim[j][0] = i;
+            r->prim[j][1] = i + 1;
+            r->prim[j][2] = i + cells + 1;
+            j++;
+            r->prim[j][0] = i + 1;
+            r->prim[j][1] = i + cells + 2;
+            r->prim[j][2] = i + cells + 1;
+            j++;
+        }
+    }
+    r->tris = g_new(NVTriangle, r->n);
+    r->list = g_new(uint32_t, r->n);
+}
+
+static const struct {
+    const char *name;
+    unsigned color_bpp;
+    bool depth, texture, blend;
+} bench_rasters[] = {
+    { "flat R5G6B5", 2, false, false, false },
+    { "flat A8R8G8B8", 4, false, false, false },
+    { "depth Z24S8", 4, true, false, false },
+    { "textured", 4, true, true, false },
+    { "textured blend", 4, true, true, true },
+};
+
+static void nv_bench_raster(void)
+{
+    NVBenchRaster r;
+    uint32_t *texels;
+    char config[64];
+    unsigned k, i, size;
+
+    for (k = 0; k < ARRAY_SIZE(bench_rasters); k++) {
+        for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+            size = bench_sizes[i];
+            memset(&r, 0, sizeof(r));
+            r.rt = (NVRenderTarget) {
+                .color_pitch = size * bench_rasters[k].color_bpp,
+                .color_bpp = bench_rasters[k].color_bpp,
+                .x1 = size,
+                .y1 = size,
+            };
+            r.rt.color = g_malloc0(size * r.rt.color_pitch);
+            if (bench_rasters[k].depth) {
+                r.rt.zeta_pitch = size * 4;
+                r.rt.zeta_bpp = 4;
+                r.rt.zeta = g_malloc(size * r.rt.zeta_pitch);
+                memset(r.rt.zeta, 0xff, size * r.rt.zeta_pitch);
+            }
+
+            /* Starting from the far plane, constant depth always passes */
+            r.ops = (NVRasterOps) {
+                .depth_test = bench_rasters[k].depth,
+                .depth_write = bench_rasters[k].depth,
+                .depth_func = NV_FUNC_LEQUAL,
+                .depth_max = 0xffffff,
+                .blend = bench_rasters[k].blend,
+                .sfactor = NV_BENCH_SRC_ALPHA,
+                .dfactor = NV_BENCH_ONE_MINUS_SRC_ALPHA,
+                .equation = NV_BENCH_FUNC_ADD,
+                .write_mask = 0xffffffff,
+            };
+            texels = NULL;
+            if (bench_rasters[k].texture) {
+                texels = nv_bench_texture(&r.ops.tex[0], 256);
+            }
+            nv_bench_grid(&r, size);
+
+            snprintf(config, sizeof(config), "%s %ux%u",
+                     bench_rasters[k].name, size, size);
+            nv_bench_run("raster", config, nv_bench_raster_fn, &r);
+
+            g_free(texels);
+            g_free(r.v);
+            g_free(r.prim);
+            g_free(r.tris);
+            g_free(r.list);
+            g_free(r.rt.color);
+            g_free(r.rt.zeta);
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(void);
+} bench_kernels[] = {
+    { "decode", nv_bench_decode },
+    { "convert", nv_bench_convert },
+    { "sample", nv_bench_sample },
+    { "raster", nv_bench_raster },
+};
+
+static void usage(const char *prog)
+{
+    unsigned i;
+
+    fprintf(stderr, "Usage: %s [-t <ms per configuration>] [kernel...]\n"
+            "Kernels:", prog);
+    for (i = 0; i < ARRAY_SIZE(bench_kernels); i++) {
+        fprintf(stderr, " %s", bench_kernels[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned i;
+    int c;
+
+    while ((c = getopt(argc, argv, "ht:")) != -1) {
+        switch (c) {
+        case 't':
+            bench_ns = atoi(optarg) * SCALE_MS;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    bench_filter = argv + optind;
+
+    for (i = 0; i < ARRAY_SIZE(bench_kernels); i++) {
+        if (nv_bench_wanted(bench_kernels[i].name)) {
+            bench_kernels[i].fn();
+        }
+    }
+    return EXIT_SUCCESS;
+}